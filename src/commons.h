@@ -19,6 +19,13 @@
 #define LON_UNDEFINED 181.0                 // Undefined (ie: unset) value for longitude
 #define MINIMUM_CLIGHTD_VERSION_MAJ 4       // Clightd minimum required maj version
 #define MINIMUM_CLIGHTD_VERSION_MIN 0       // Clightd minimum required min version
+#define LATENCY_BUCKETS 12                  // dim/undim latency histogram buckets, in ms: [0, 1), [1, 2), [2, 4), ..., [1024, inf)
+
+/* Curves followed by GAMMA long transitions */
+enum gamma_curves { LINEAR_CURVE, SIGMOID_CURVE, SIZE_CURVES };
+
+/* Rate-limited INTERFACE bus method classes */
+enum rate_classes { RATE_CALIBRATE, RATE_INHIBIT, RATE_LOAD, RATE_CONF, SIZE_RATE };
 
 /** Generic structs **/
 
@@ -28,6 +35,7 @@ typedef struct {
     int timeout[SIZE_AC][SIZE_STATES + 1];  // timeout between captures for each ac_state and time state (day/night + during event)
     char dev_name[PATH_MAX + 1];            // video device (eg: /dev/video0) to be used for captures
     char dev_opts[NAME_MAX + 1];            // sensor capture options
+    int native_capture;                     // capture webcam frames in-process through V4L2 instead of through clightd
     char screen_path[PATH_MAX + 1];         // screen syspath (eg: /sys/class/backlight/intel_backlight)
     int temp[SIZE_STATES];                  // screen temperature for each state
     loc_t loc;                              // user location as loaded by config
@@ -52,6 +60,7 @@ typedef struct {
     int no_keyboard_bl;                     // disable keyboard backlight automatic calibration (where supported)
     double shutter_threshold;               // capture values below this threshold will be considered "shuttered"
     int gamma_long_transition;              // flag to enable a very long smooth transition for gamma (redshift-like)
+    enum gamma_curves gamma_trans_curve;    // curve followed by gamma long transitions
     int ambient_gamma;                      // enable gamma adjustments based on ambient backlight
     int inhibit_autocalib;                  // whether to inhibit backlight autocalibration too when Screensaver inhibition is enabled
     int screen_timeout[SIZE_AC];            // screen timeouts
@@ -62,6 +71,10 @@ typedef struct {
     int no_dimmer;
     int no_dpms;
     int no_screen;
+    int history_size;                       // number of records kept in ambient/backlight/temperature history file (0 to disable)
+    int simulate_window;                    // seconds within which SimulateUserActivity requests are coalesced (<= 0 to disable)
+    int control_socket;                     // whether to expose $XDG_RUNTIME_DIR/clight.sock control/event-stream socket
+    int rate_limit[SIZE_RATE];              // max bus calls per minute allowed to each sender, for each method class (0 to disable)
 } conf_t;
 
 /* Global state of program */
@@ -83,6 +96,15 @@ typedef struct {
     bool inhibited;                         // whether screensaver inhibition is enabled
     loc_t current_loc;                      // current user location
     double screen_comp;                     // current screen-emitted brightness compensation
+    uint64_t gamma_skipped_sets;            // number of redundant GAMMA temp sets skipped
+    bool suspended;                         // whether system is going to sleep
+    uint64_t resume_latency;                // ms elapsed between last resume and first backlight level set
+    uint64_t simulate_coalesced;            // number of SimulateUserActivity requests coalesced by IDLER
+    uint64_t inhibit_monitored;             // number of messages received while monitoring org.freedesktop.ScreenSaver
+    uint64_t inhibit_monitor_handled;       // number of monitored messages that actually created/dropped an inhibition
+    struct timespec idle_ts;                // CLOCK_MONOTONIC time of last IDLER idle/active transition
+    uint64_t display_latency[SIZE_DIM][LATENCY_BUCKETS];  // histograms of latency between idle transition and dimmed/restored backlight
+    uint64_t rate_limited;                  // number of bus calls refused because their sender exceeded its rate limit
     jmp_buf quit_buf;                       // quit jump called by longjmp
     char clightd_version[32];               // Clightd found version
     char version[32];                       // Clight version
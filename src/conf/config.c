@@ -1,7 +1,9 @@
+#include <fcntl.h>
 #include <libconfig.h>
 #include "config.h"
 
 static void init_config_file(enum CONFIG file, char *filename);
+static int write_config_atomic(config_t *cfg, const char *config_file);
 
 static void init_config_file(enum CONFIG file, char *filename) {
     switch (file) {
@@ -23,7 +25,7 @@ static void init_config_file(enum CONFIG file, char *filename) {
 int read_config(enum CONFIG file, char *config_file) {
     int r = 0;
     config_t cfg;
-    const char *sensor_dev, *screendev, *sunrise, *sunset, *sensor_settings;
+    const char *sensor_dev, *screendev, *sunrise, *sunset, *sensor_settings, *curve;
 
     if (!strlen(config_file)) {
         init_config_file(file, config_file);
@@ -60,6 +62,10 @@ int read_config(enum CONFIG file, char *config_file) {
         config_lookup_float(&cfg, "screen_contrib", &conf.screen_contrib);
         config_lookup_int(&cfg, "screen_samples", &conf.screen_samples);
         config_lookup_bool(&cfg, "inhibit_autocalib", &conf.inhibit_autocalib);
+        config_lookup_bool(&cfg, "native_capture", &conf.native_capture);
+        config_lookup_int(&cfg, "history_size", &conf.history_size);
+        config_lookup_int(&cfg, "simulate_window", &conf.simulate_window);
+        config_lookup_bool(&cfg, "control_socket", &conf.control_socket);
 
         if (config_lookup_string(&cfg, "sensor_devname", &sensor_dev) == CONFIG_TRUE) {
             strncpy(conf.dev_name, sensor_dev, sizeof(conf.dev_name) - 1);
@@ -76,8 +82,17 @@ int read_config(enum CONFIG file, char *config_file) {
         if (config_lookup_string(&cfg, "sunset", &sunset) == CONFIG_TRUE) {
             strncpy(conf.day_events[SUNSET], sunset, sizeof(conf.day_events[SUNSET]) - 1);
         }
+        if (config_lookup_string(&cfg, "gamma_trans_curve", &curve) == CONFIG_TRUE) {
+            if (!strcmp(curve, "sigmoid")) {
+                conf.gamma_trans_curve = SIGMOID_CURVE;
+            } else if (!strcmp(curve, "linear")) {
+                conf.gamma_trans_curve = LINEAR_CURVE;
+            } else {
+                WARN("Wrong gamma_trans_curve value.\n");
+            }
+        }
 
-        config_setting_t *points, *root, *timeouts, *gamma;
+        config_setting_t *points, *root, *timeouts, *gamma, *limits;
         root = config_root_setting(&cfg);
 
         /* Load no_smooth_dimmer options */
@@ -204,6 +219,17 @@ int read_config(enum CONFIG file, char *config_file) {
                 WARN("Wrong number of screen_timeouts array elements.\n");
             }
         }
+        
+        /* Load rate limits */
+        if ((limits = config_setting_get_member(root, "rate_limits"))) {
+            if (config_setting_length(limits) == SIZE_RATE) {
+                for (int i = 0; i < SIZE_RATE; i++) {
+                    conf.rate_limit[i] = config_setting_get_int_elem(limits, i);
+                }
+            } else {
+                WARN("Wrong number of rate_limits array elements.\n");
+            }
+        }
 
     } else {
         WARN("Config file: %s at line %d.\n",
@@ -215,7 +241,7 @@ int read_config(enum CONFIG file, char *config_file) {
     return r;
 }
 
-int store_config(enum CONFIG file) {
+int store_config(enum CONFIG file, const conf_t *c) {
     int r = 0;
     config_t cfg;
     char config_file[PATH_MAX + 1] = {0};
@@ -228,138 +254,158 @@ int store_config(enum CONFIG file) {
 
     config_setting_t *root = config_root_setting(&cfg);
     config_setting_t *setting = config_setting_add(root, "captures", CONFIG_TYPE_INT);
-    config_setting_set_int(setting, conf.num_captures);
+    config_setting_set_int(setting, c->num_captures);
 
     setting = config_setting_add(root, "no_smooth_backlight_transition", CONFIG_TYPE_BOOL);
-    config_setting_set_bool(setting, conf.no_smooth_backlight);
+    config_setting_set_bool(setting, c->no_smooth_backlight);
 
     setting = config_setting_add(root, "no_smooth_gamma_transition", CONFIG_TYPE_BOOL);
-    config_setting_set_bool(setting, conf.no_smooth_gamma);
+    config_setting_set_bool(setting, c->no_smooth_gamma);
 
     setting = config_setting_add(root, "no_smooth_dimmer_transition", CONFIG_TYPE_ARRAY);
     for (int i = 0; i < SIZE_DIM; i++) {
-        config_setting_set_bool_elem(setting, -1, conf.no_smooth_dimmer[i]);
+        config_setting_set_bool_elem(setting, -1, c->no_smooth_dimmer[i]);
     }
 
     setting = config_setting_add(root, "backlight_trans_step", CONFIG_TYPE_FLOAT);
-    config_setting_set_float(setting, conf.backlight_trans_step);
+    config_setting_set_float(setting, c->backlight_trans_step);
 
     setting = config_setting_add(root, "gamma_trans_step", CONFIG_TYPE_INT);
-    config_setting_set_int(setting, conf.gamma_trans_step);
+    config_setting_set_int(setting, c->gamma_trans_step);
 
     setting = config_setting_add(root, "dimmer_trans_steps", CONFIG_TYPE_ARRAY);
     for (int i = 0; i < SIZE_DIM; i++) {
-        config_setting_set_float_elem(setting, -1, conf.dimmer_trans_step[i]);
+        config_setting_set_float_elem(setting, -1, c->dimmer_trans_step[i]);
     }
 
     setting = config_setting_add(root, "backlight_trans_timeout", CONFIG_TYPE_INT);
-    config_setting_set_int(setting, conf.backlight_trans_timeout);
+    config_setting_set_int(setting, c->backlight_trans_timeout);
 
     setting = config_setting_add(root, "gamma_trans_timeout", CONFIG_TYPE_INT);
-    config_setting_set_int(setting, conf.gamma_trans_timeout);
+    config_setting_set_int(setting, c->gamma_trans_timeout);
 
     setting = config_setting_add(root, "dimmer_trans_timeouts", CONFIG_TYPE_ARRAY);
     for (int i = 0; i < SIZE_DIM; i++) {
-        config_setting_set_int_elem(setting, -1, conf.dimmer_trans_timeout[i]);
+        config_setting_set_int_elem(setting, -1, c->dimmer_trans_timeout[i]);
     }
     
     setting = config_setting_add(root, "gamma_long_transition", CONFIG_TYPE_BOOL);
-    config_setting_set_bool(setting, conf.gamma_long_transition);
+    config_setting_set_bool(setting, c->gamma_long_transition);
+    
+    setting = config_setting_add(root, "gamma_trans_curve", CONFIG_TYPE_STRING);
+    config_setting_set_string(setting, c->gamma_trans_curve == SIGMOID_CURVE ? "sigmoid" : "linear");
     
     setting = config_setting_add(root, "ambient_gamma", CONFIG_TYPE_BOOL);
-    config_setting_set_bool(setting, conf.ambient_gamma);
+    config_setting_set_bool(setting, c->ambient_gamma);
 
-    if (conf.loc.lat != LAT_UNDEFINED && conf.loc.lon != LON_UNDEFINED) {
+    if (c->loc.lat != LAT_UNDEFINED && c->loc.lon != LON_UNDEFINED) {
         setting = config_setting_add(root, "latitude", CONFIG_TYPE_FLOAT);
-        config_setting_set_float(setting, conf.loc.lat);
+        config_setting_set_float(setting, c->loc.lat);
         setting = config_setting_add(root, "longitude", CONFIG_TYPE_FLOAT);
-        config_setting_set_float(setting, conf.loc.lon);
+        config_setting_set_float(setting, c->loc.lon);
     }
 
     setting = config_setting_add(root, "event_duration", CONFIG_TYPE_INT);
-    config_setting_set_int(setting, conf.event_duration);
+    config_setting_set_int(setting, c->event_duration);
 
     setting = config_setting_add(root, "dimmer_pct", CONFIG_TYPE_FLOAT);
-    config_setting_set_float(setting, conf.dimmer_pct);
+    config_setting_set_float(setting, c->dimmer_pct);
 
     setting = config_setting_add(root, "verbose", CONFIG_TYPE_BOOL);
-    config_setting_set_bool(setting, conf.verbose);
+    config_setting_set_bool(setting, c->verbose);
 
     setting = config_setting_add(root, "no_auto_calibration", CONFIG_TYPE_BOOL);
-    config_setting_set_bool(setting, conf.no_auto_calib);
+    config_setting_set_bool(setting, c->no_auto_calib);
 
     setting = config_setting_add(root, "no_kdb_backlight", CONFIG_TYPE_BOOL);
-    config_setting_set_bool(setting, conf.no_keyboard_bl);
+    config_setting_set_bool(setting, c->no_keyboard_bl);
     
     setting = config_setting_add(root, "inhibit_autocalib", CONFIG_TYPE_BOOL);
-    config_setting_set_bool(setting, conf.inhibit_autocalib);
+    config_setting_set_bool(setting, c->inhibit_autocalib);
 
     setting = config_setting_add(root, "sensor_devname", CONFIG_TYPE_STRING);
-    config_setting_set_string(setting, conf.dev_name);
+    config_setting_set_string(setting, c->dev_name);
     
     setting = config_setting_add(root, "sensor_settings", CONFIG_TYPE_STRING);
-    config_setting_set_string(setting, conf.dev_opts);
+    config_setting_set_string(setting, c->dev_opts);
+    
+    setting = config_setting_add(root, "native_capture", CONFIG_TYPE_BOOL);
+    config_setting_set_bool(setting, c->native_capture);
 
     setting = config_setting_add(root, "screen_sysname", CONFIG_TYPE_STRING);
-    config_setting_set_string(setting, conf.screen_path);
+    config_setting_set_string(setting, c->screen_path);
 
     setting = config_setting_add(root, "sunrise", CONFIG_TYPE_STRING);
-    config_setting_set_string(setting, conf.day_events[SUNRISE]);
+    config_setting_set_string(setting, c->day_events[SUNRISE]);
 
     setting = config_setting_add(root, "sunset", CONFIG_TYPE_STRING);
-    config_setting_set_string(setting, conf.day_events[SUNSET]);
+    config_setting_set_string(setting, c->day_events[SUNSET]);
 
     setting = config_setting_add(root, "shutter_threshold", CONFIG_TYPE_FLOAT);
-    config_setting_set_float(setting, conf.shutter_threshold);
+    config_setting_set_float(setting, c->shutter_threshold);
     
     setting = config_setting_add(root, "screen_samples", CONFIG_TYPE_INT);
-    config_setting_set_int(setting, conf.screen_samples);
+    config_setting_set_int(setting, c->screen_samples);
     
     setting = config_setting_add(root, "screen_contrib", CONFIG_TYPE_FLOAT);
-    config_setting_set_float(setting, conf.screen_contrib);
+    config_setting_set_float(setting, c->screen_contrib);
+    
+    setting = config_setting_add(root, "history_size", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, c->history_size);
+    
+    setting = config_setting_add(root, "simulate_window", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, c->simulate_window);
+    
+    setting = config_setting_add(root, "control_socket", CONFIG_TYPE_BOOL);
+    config_setting_set_bool(setting, c->control_socket);
 
     /* -1 here below means append to end of array */
     setting = config_setting_add(root, "ac_backlight_regression_points", CONFIG_TYPE_ARRAY);
-    for (int i = 0; i < conf.num_points[ON_AC]; i++) {
-        config_setting_set_float_elem(setting, -1, conf.regression_points[ON_AC][i]);
+    for (int i = 0; i < c->num_points[ON_AC]; i++) {
+        config_setting_set_float_elem(setting, -1, c->regression_points[ON_AC][i]);
     }
 
     setting = config_setting_add(root, "batt_backlight_regression_points", CONFIG_TYPE_ARRAY);
-    for (int i = 0; i < conf.num_points[ON_BATTERY]; i++) {
-        config_setting_set_float_elem(setting, -1, conf.regression_points[ON_BATTERY][i]);
+    for (int i = 0; i < c->num_points[ON_BATTERY]; i++) {
+        config_setting_set_float_elem(setting, -1, c->regression_points[ON_BATTERY][i]);
     }
 
     setting = config_setting_add(root, "dpms_timeouts", CONFIG_TYPE_ARRAY);
     for (int i = 0; i < SIZE_AC; i++) {
-        config_setting_set_int_elem(setting, -1, conf.dpms_timeout[i]);
+        config_setting_set_int_elem(setting, -1, c->dpms_timeout[i]);
     }
 
     setting = config_setting_add(root, "ac_capture_timeouts", CONFIG_TYPE_ARRAY);
     for (int i = 0; i < SIZE_STATES + 1; i++) {
-        config_setting_set_int_elem(setting, -1, conf.timeout[ON_AC][i]);
+        config_setting_set_int_elem(setting, -1, c->timeout[ON_AC][i]);
     }
 
     setting = config_setting_add(root, "batt_capture_timeouts", CONFIG_TYPE_ARRAY);
     for (int i = 0; i < SIZE_STATES + 1; i++) {
-        config_setting_set_int_elem(setting, -1, conf.timeout[ON_BATTERY][i]);
+        config_setting_set_int_elem(setting, -1, c->timeout[ON_BATTERY][i]);
     }
 
     setting = config_setting_add(root, "dimmer_timeouts", CONFIG_TYPE_ARRAY);
     for (int i = 0; i < SIZE_AC; i++) {
-        config_setting_set_int_elem(setting, -1, conf.dimmer_timeout[i]);
+        config_setting_set_int_elem(setting, -1, c->dimmer_timeout[i]);
     }
 
     setting = config_setting_add(root, "gamma_temp", CONFIG_TYPE_ARRAY);
     for (int i = 0; i < SIZE_STATES; i++) {
-        config_setting_set_int_elem(setting, -1, conf.temp[i]);
+        config_setting_set_int_elem(setting, -1, c->temp[i]);
     }
     
     setting = config_setting_add(root, "screen_timeouts", CONFIG_TYPE_ARRAY);
     for (int i = 0; i < SIZE_AC; i++) {
-        config_setting_set_int_elem(setting, -1, conf.screen_timeout[i]);
+        config_setting_set_int_elem(setting, -1, c->screen_timeout[i]);
+    }
+    
+    setting = config_setting_add(root, "rate_limits", CONFIG_TYPE_ARRAY);
+    for (int i = 0; i < SIZE_RATE; i++) {
+        config_setting_set_int_elem(setting, -1, c->rate_limit[i]);
     }
 
-    if(config_write_file(&cfg, config_file) != CONFIG_TRUE) {
+    if (write_config_atomic(&cfg, config_file) != 0) {
         WARN("Failed to write new config to file.\n");
         r = -1;
     } else {
@@ -368,3 +414,44 @@ int store_config(enum CONFIG file) {
     config_destroy(&cfg);
     return r;
 }
+
+/*
+ * Write config to a temp file in the same folder, flush it to disk,
+ * then rename it over config_file: a crash or a concurrent read
+ * will never see a partially written config.
+ */
+static int write_config_atomic(config_t *cfg, const char *config_file) {
+    char tmp_file[PATH_MAX + 1] = {0};
+    snprintf(tmp_file, PATH_MAX, "%s.tmp", config_file);
+    
+    if (config_write_file(cfg, tmp_file) != CONFIG_TRUE) {
+        return -1;
+    }
+    
+    int r = -1;
+    int fd = open(tmp_file, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (fsync(fd) == 0 && rename(tmp_file, config_file) == 0) {
+            r = 0;
+        }
+        close(fd);
+    }
+    if (r != 0) {
+        unlink(tmp_file);
+        return r;
+    }
+    
+    /* Persist the rename too */
+    char dir[PATH_MAX + 1] = {0};
+    strncpy(dir, config_file, PATH_MAX);
+    char *sep = strrchr(dir, '/');
+    if (sep) {
+        *sep = '\0';
+        fd = open(strlen(dir) ? dir : "/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+    }
+    return 0;
+}
@@ -5,4 +5,4 @@
 enum CONFIG { GLOBAL, LOCAL, CUSTOM };
 
 int read_config(enum CONFIG file, char *config_file);
-int store_config(enum CONFIG file);
+int store_config(enum CONFIG file, const conf_t *c);
@@ -42,6 +42,9 @@ void init_opts(int argc, char *argv[]) {
     /* DPMS */
     conf.dpms_timeout[ON_AC] = 900;
     conf.dpms_timeout[ON_BATTERY] = 300;
+    
+    /* IDLER */
+    conf.simulate_window = 5;
 
     /* SCREEN */
     conf.screen_timeout[ON_AC] = 30;
@@ -49,6 +52,13 @@ void init_opts(int argc, char *argv[]) {
     conf.screen_contrib = 0.1;
     conf.screen_samples = 10;
     
+    /* HISTORY */
+    conf.history_size = 512 * 1024;
+    conf.rate_limit[RATE_CALIBRATE] = 12;
+    conf.rate_limit[RATE_INHIBIT] = 60;
+    conf.rate_limit[RATE_LOAD] = 6;
+    conf.rate_limit[RATE_CONF] = 120;
+    
     /* LOCATION */
     conf.loc.lat = LAT_UNDEFINED;
     conf.loc.lon = LON_UNDEFINED;
@@ -281,6 +291,10 @@ static void check_conf(void) {
         WARN("Wrong nightly temp value. Resetting default value.\n");
         conf.temp[NIGHT] = 4000;
     }
+    if (conf.gamma_trans_curve < LINEAR_CURVE || conf.gamma_trans_curve >= SIZE_CURVES) {
+        WARN("Wrong gamma transition curve value. Resetting default value.\n");
+        conf.gamma_trans_curve = LINEAR_CURVE;
+    }
     if (conf.event_duration <= 0) {
         WARN("Wrong event duration value. Resetting default value.\n");
         conf.event_duration = 30 * 60;
@@ -388,4 +402,16 @@ static void check_conf(void) {
         WARN("Wrong screen_samples value. Resetting default value.\n");
         conf.screen_samples = 10;
     }
+    
+    if (conf.history_size < 0) {
+        WARN("Wrong history_size value. Resetting default value.\n");
+        conf.history_size = 512 * 1024;
+    }
+    
+    for (i = 0; i < SIZE_RATE; i++) {
+        if (conf.rate_limit[i] < 0) {
+            WARN("Wrong rate_limits value. Disabling rate limit.\n");
+            conf.rate_limit[i] = 0;
+        }
+    }
 }
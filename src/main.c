@@ -21,16 +21,14 @@
  *
  * END_COMMON_COPYRIGHT_HEADER */
 
-#include <glob.h>
 #include <module/modules_easy.h>
 #include "opts.h"
+#include "loader.h"
 
 static void init(int argc, char *argv[]);
 static void init_state(void);
 static void sigsegv_handler(int signum);
 static void check_clightd_version(void);
-static void init_user_mod_path(enum CONFIG file, char *filename);
-static void load_user_modules(enum CONFIG file);
 
 state_t state = {0};
 conf_t conf = {0};
@@ -79,15 +77,10 @@ static void init(int argc, char *argv[]) {
     
     init_state();
     /* 
-     * Load user custom modules after opening log (thus this information is logged).
-     * Note that local (ie: placed in $HOME) modules have higher priority,
-     * thus one can override a global module (placed in /usr/share/clight/modules.d/)
-     * by creating a module with same name in $HOME.
-     * 
-     * Clight internal modules cannot be overriden.
+     * Load user custom modules after opening log (thus this information is logged),
+     * and before modules are started, so that they won't miss any update.
      */
-    load_user_modules(LOCAL);
-    load_user_modules(GLOBAL);
+    loader_load_user_modules();
 }
 
 static void init_state(void) {
@@ -135,37 +128,3 @@ static void check_clightd_version(void) {
         }
     }
 }
-
-static void init_user_mod_path(enum CONFIG file, char *filename) {
-    switch (file) {
-        case LOCAL:
-            if (getenv("XDG_DATA_HOME")) {
-                snprintf(filename, PATH_MAX, "%s/clight/modules.d/*", getenv("XDG_DATA_HOME"));
-            } else {
-                snprintf(filename, PATH_MAX, "%s/.local/share/clight/modules.d/*", getpwuid(getuid())->pw_dir);
-            }
-            break;
-        case GLOBAL:
-            snprintf(filename, PATH_MAX, "%s/modules.d/*", DATADIR);
-            break;
-        default:
-            break;
-    }    
-}
-
-static void load_user_modules(enum CONFIG file) {
-    char modules_path[PATH_MAX + 1];
-    init_user_mod_path(file, modules_path);
-    
-    glob_t gl = {0};
-    if (glob(modules_path, GLOB_NOSORT | GLOB_ERR, NULL, &gl) == 0) {
-        for (int i = 0; i < gl.gl_pathc; i++) {
-            if (m_load(gl.gl_pathv[i]) == MOD_OK) {
-                INFO("'%s' loaded.\n", gl.gl_pathv[i]);
-            } else {
-                WARN("'%s' failed to load.\n", gl.gl_pathv[i]);
-            }
-        }
-        globfree(&gl);
-    }
-}
@@ -1,5 +1,9 @@
 #include "bus.h"
 #include "my_math.h"
+#include "camera.h"
+#include "stats.h"
+#include "mirror.h"
+#include "sleep.h"
 
 enum backlight_pause { UNPAUSED = 0, DISPLAY = 1, SENSOR = 2, AUTOCALIB = 4, INHIBIT = 8 };
 
@@ -7,10 +11,11 @@ static void receive_paused(const msg_t *const msg, const void* userdata);
 static void init_kbd_backlight(void);
 static int is_sensor_available(void);
 static void do_capture(bool reset_timer);
+static void capture_done(bool apply);
 static void set_new_backlight(const double perc);
 static void set_backlight_level(const double pct, const int is_smooth, const double step, const int timeout);
 static void set_keyboard_level(const double level);
-static int capture_frames_brightness(void);
+static int capture_frames_brightness(double *intensity, int r);
 static void upower_callback(void);
 static void interface_autocalib_callback(bool new_val);
 static void interface_curve_callback(curve_upd *up);
@@ -21,13 +26,19 @@ static int on_sensor_change(sd_bus_message *m, void *userdata, sd_bus_error *ret
 static int get_current_timeout(void);
 static void on_inbhibit_update(void);
 static void pause_mod(enum backlight_pause type);
+static void resume_callback(void);
 static void resume_mod(enum backlight_pause type);
 
 static int sensor_available;
 static int max_kbd_backlight;
 static int bl_fd = -1;
+static int sleep_id = -1;
+static int camera_fd = -1;            // signals completion of a native capture running off main loop
+static bool capturing;                // whether a native capture is running
+static bool capture_reset_timer;      // whether to reset capture timer once running capture completes
 static int paused_state;              // counter of how many sources are pausing BACKLIGHT (state.display_state, sensor_available, conf.no_auto_calib)
 static sd_bus_slot *slot;
+static stats_t frames;                // brightness of frames of last capture
 
 DECLARE_MSG(bl_msg, BL_UPD);
 DECLARE_MSG(kbd_msg, KBD_BL_UPD);
@@ -54,6 +65,9 @@ static void init(void) {
     M_SUB(NO_AUTOCALIB_REQ);
     M_SUB(BL_REQ);
     M_SUB(KBD_BL_REQ);
+    M_SUB(SUSPEND_UPD);
+    M_SUB(RESUME_UPD);
+    sleep_id = sleep_register();
 
     /* We do not fail if this fails */
     SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Sensor", "org.clightd.clightd.Sensor", "Changed");
@@ -97,19 +111,29 @@ static bool evaluate(void) {
 }
 
 static void destroy(void) {
+    sleep_deregister(sleep_id);
     if (slot) {
         slot = sd_bus_slot_unref(slot);
     }
     if (bl_fd >= 0) {
         close(bl_fd);
     }
+    if (camera_fd >= 0) {
+        /* Waits for any running capture */
+        camera_capture_stop();
+    }
+    stats_free(&frames);
 }
 
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
     case FD_UPD:
-        read_timer(msg->fd_msg->fd);
-        M_PUB(&capture_req);
+        if (msg->fd_msg->fd == camera_fd) {
+            capture_done(true);
+        } else {
+            read_timer(msg->fd_msg->fd);
+            M_PUB(&capture_req);
+        }
         break;
     case UPOWER_UPD:
         upower_callback();
@@ -126,6 +150,13 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     case INHIBIT_UPD:
         on_inbhibit_update();
         break;
+    case SUSPEND_UPD:
+        set_timeout(0, 0, bl_fd, 0);
+        sleep_ack(sleep_id);
+        break;
+    case RESUME_UPD:
+        resume_callback();
+        break;
     case BL_TO_REQ: {
         timeout_upd *up = (timeout_upd *)MSG_DATA();
         interface_timeout_callback(up);
@@ -173,14 +204,29 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
 
 static void receive_paused(const msg_t *const msg, UNUSED const void* userdata) {
     DEBUG("Received event %d\n", MSG_TYPE());
-    /* In paused state we have deregistered our fd, thus we can only receive PubSub messages */
+    /* 
+     * In paused state we have deregistered our timer fd, 
+     * thus we can only receive PubSub messages and native capture completions
+     */
     switch (MSG_TYPE()) {
+    case FD_UPD:
+        /* Same checks as CAPTURE_REQ below: we may have been dimmed while capturing */
+        capture_done(!state.display_state && sensor_available);
+        break;
     case DISPLAY_UPD:
         dimmed_callback();
         break;
     case INHIBIT_UPD:
         on_inbhibit_update();
         break;
+    case SUSPEND_UPD:
+        set_timeout(0, 0, bl_fd, 0);
+        sleep_ack(sleep_id);
+        break;
+    case RESUME_UPD:
+        /* Just rearm timer: it will fire when we are resumed */
+        set_timeout(get_current_timeout(), 0, bl_fd, 0);
+        break;
     case CURVE_REQ: {
         curve_upd *up = (curve_upd *)MSG_DATA();
         if (VALIDATE_REQ(up)) {
@@ -238,8 +284,44 @@ static int is_sensor_available(void) {
     return r == 0 && available;
 }
 
+/*
+ * Native captures run on a thread, off main loop: 
+ * capture_done() is called once camera_fd signals their completion.
+ * Capture requests received meanwhile are merged into the running one.
+ */
 static void do_capture(bool reset_timer) {
-    if (!capture_frames_brightness()) {
+    capture_reset_timer |= reset_timer;
+    if (capturing) {
+        return;
+    }
+    if (conf.native_capture) {
+        const int fd = camera_capture_start(conf.dev_name, conf.num_captures);
+        if (fd >= 0) {
+            if (camera_fd == -1) {
+                camera_fd = fd;
+                m_register_fd(camera_fd, false, NULL);
+            }
+            capturing = true;
+            return;
+        }
+        DEBUG("Failed to start native capture. Falling back to Clightd.\n");
+    }
+    capture_done(true);
+}
+
+static void capture_done(bool apply) {
+    double intensity[conf.num_captures];
+    int r = -1;
+    if (capturing) {
+        capturing = false;
+        /* Fails too if conf.num_captures was changed through bus api meanwhile */
+        r = camera_capture_finish(intensity, conf.num_captures);
+        if (r && apply) {
+            DEBUG("Native capture failed. Falling back to Clightd.\n");
+        }
+    }
+    
+    if (apply && !capture_frames_brightness(intensity, r)) {
         /* Account for screen-emitted brightness */
         const double compensated_br = clamp(state.ambient_br - state.screen_comp, 1, 0);
         if (compensated_br >= conf.shutter_threshold) {
@@ -256,7 +338,8 @@ static void do_capture(bool reset_timer) {
         }
     }
 
-    if (reset_timer) {
+    if (capture_reset_timer) {
+        capture_reset_timer = false;
         set_timeout(get_current_timeout(), 0, bl_fd, 0);
     }
 }
@@ -300,7 +383,7 @@ static void set_backlight_level(const double pct, const int is_smooth, const dou
     int ok;
     int r = call(&ok, "b", &args, "d(bdu)s", pct, is_smooth, step, timeout, conf.screen_path);
     if (!r && ok) {
-        bl_msg.bl.old = state.current_bl_pct;
+        bl_msg.bl.old = mirror_get_bl();
         state.current_bl_pct = pct;
         bl_msg.bl.new = pct;
         bl_msg.bl.smooth = is_smooth;
@@ -310,14 +393,26 @@ static void set_backlight_level(const double pct, const int is_smooth, const dou
     }
 }
 
-static int capture_frames_brightness(void) {
-    SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Sensor", "org.clightd.clightd.Sensor", "Capture");
-    double intensity[conf.num_captures];
-    int r = call(intensity, "sad", &args, "sis", conf.dev_name, conf.num_captures, conf.dev_opts);
+/* r is native capture result: on failure, intensity is filled by Clightd */
+static int capture_frames_brightness(double *intensity, int r) {
+    if (r) {
+        SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Sensor", "org.clightd.clightd.Sensor", "Capture");
+        r = call(intensity, "sad", &args, "sis", conf.dev_name, conf.num_captures, conf.dev_opts);
+    }
     if (!r) {
+        /* conf.num_captures can be changed through bus api */
+        if (frames.capacity != conf.num_captures) {
+            stats_free(&frames);
+            stats_init(&frames, conf.num_captures, 0.0, false);
+        }
+        stats_reset(&frames);
+        for (int i = 0; i < conf.num_captures; i++) {
+            stats_push(&frames, intensity[i]);
+        }
+        
         amb_msg.bl.old = state.ambient_br;
-        state.ambient_br = compute_average(intensity, conf.num_captures);
-        DEBUG("Captured ambient brightness: %lf.\n", state.ambient_br);
+        state.ambient_br = stats_mean(&frames);
+        DEBUG("Captured ambient brightness: %lf (variance: %lf).\n", state.ambient_br, stats_variance(&frames));
         amb_msg.bl.new = state.ambient_br;
         M_PUB(&amb_msg);
     }
@@ -344,12 +439,16 @@ static void interface_autocalib_callback(bool new_val) {
 static void interface_curve_callback(curve_upd *up) {
     memcpy(conf.regression_points[up->state], up->regression_points, up->num_points * sizeof(double));
     conf.num_points[up->state] = up->num_points;
-    polynomialfit(up->state);
+    /* Curve for other ac state may have been stored along with this one by INTERFACE SetMany */
+    for (enum ac_states st = ON_AC; st < SIZE_AC; st++) {
+        polynomialfit(st);
+    }
 }
 
 /* Callback on "backlight_timeout" bus exposed writable properties */
 static void interface_timeout_callback(timeout_upd *up) {
-    if (up->state >= ON_AC && up->state < SIZE_AC && up->daytime >= DAY && up->daytime < SIZE_STATES) {
+    /* IN_EVENT daytime sets the timeout used during events */
+    if (up->state >= ON_AC && up->state < SIZE_AC && up->daytime >= DAY && up->daytime <= IN_EVENT) {
         const int old = get_current_timeout();
         conf.timeout[up->state][up->daytime] = up->new;
         if (up->state == state.ac_state && (up->daytime == state.day_time || (state.in_event && up->daytime == IN_EVENT))) {
@@ -442,3 +541,12 @@ static void resume_mod(enum backlight_pause type) {
         m_register_fd(bl_fd, false, NULL);
     }
 }
+
+/* Ambient brightness likely changed while sleeping: immediately capture */
+static void resume_callback(void) {
+    if (sensor_available) {
+        do_capture(true);
+    } else {
+        set_timeout(get_current_timeout(), 0, bl_fd, 0);
+    }
+}
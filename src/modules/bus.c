@@ -1,3 +1,4 @@
+#include <fcntl.h>
 #include "bus.h"
 
 #define GET_BUS(a)  sd_bus *tmp = a->bus; if (!tmp) { tmp = a->type == USER_BUS ? userbus : sysbus; } if (!tmp) { return -1; }
@@ -175,6 +176,13 @@ int call(void *userptr, const char *userptr_type, const struct bus_args *a, cons
             if (r >= 0) {
                 strncpy(userptr, obj, PATH_MAX);
             }
+        } else if (userptr_type[0] == 'h') {
+            /* Fds are owned by reply message: dup it to let caller own it */
+            int fd;
+            r = sd_bus_message_read(reply, "h", &fd);
+            if (r >= 0) {
+                *(int *)userptr = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+            }
         } else if (userptr_type[0] == 'a') {
             const void *data = NULL;
             size_t length;
@@ -209,6 +217,20 @@ int add_match(const struct bus_args *a, sd_bus_slot **slot, sd_bus_message_handl
     return check_err(&r, NULL, a->caller);
 }
 
+/*
+ * Add a match on a signal whose first argument is arg0,
+ * so that bus daemon only forwards us the signals we are interested in.
+ */
+int add_match_arg0(const struct bus_args *a, const char *arg0, sd_bus_slot **slot, sd_bus_message_handler_t cb) {
+    GET_BUS(a);
+
+    char match[800] = {0};
+    snprintf(match, sizeof(match), "type='signal', sender='%s', interface='%s', member='%s', path='%s', arg0='%s'", 
+             a->service, a->interface, a->member, a->path, arg0);
+    int r = sd_bus_add_match(tmp, slot, match, cb, NULL);
+    return check_err(&r, NULL, a->caller);
+}
+
 /*
  * Set property of type "type" value to "value". It correctly handles 'u' and 's' types.
  */
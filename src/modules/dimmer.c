@@ -1,24 +1,22 @@
 #include "idler.h"
 
 static void receive_inhibited(const msg_t *const msg, UNUSED const void* userdata);
-static int on_new_idle(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static void on_new_idle(bool idle);
 static void upower_timeout_callback(void);
 static void inhibit_callback(void);
 
-static sd_bus_slot *slot;
-static char client[PATH_MAX + 1];
+static int idler_id = -1;
 
 DECLARE_MSG(display_req, DISPLAY_REQ);
 
 MODULE("DIMMER");
 
 static void init(void) {
-    int r = idle_init(client, &slot, conf.dimmer_timeout[state.ac_state], on_new_idle);
-    if (r == 0) {
+    idler_id = idler_register(conf.dimmer_timeout[state.ac_state], on_new_idle);
+    if (idler_id != -1) {
         M_SUB(UPOWER_UPD);
         M_SUB(INHIBIT_UPD);
         M_SUB(DIMMER_TO_REQ);
-        M_SUB(SIMULATE_REQ);
     } else {
         WARN("Failed to init.\n");
         m_poisonpill(self());
@@ -30,7 +28,8 @@ static bool check(void) {
 }
 
 static bool evaluate(void) {
-    return !conf.no_dimmer && state.ac_state != -1;
+    /* Wait for IDLER init, so that idler_register() failures are caught */
+    return !conf.no_dimmer && state.ac_state != -1 && idler_started();
 }
 
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
@@ -51,13 +50,6 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
         }
         break;
     }
-    case SIMULATE_REQ: {
-        /* Validation is useless here; only for coherence */
-        if (VALIDATE_REQ((void *)msg->ps_msg->message)) {
-            idle_client_reset(client, conf.dimmer_timeout[state.ac_state]);
-        }
-        break;
-    }
     default:
         break;
     }
@@ -82,50 +74,42 @@ static void receive_inhibited(const msg_t *const msg, UNUSED const void* userdat
         break;
     }
     default:
-        /* SIMULATE_REQ is not handled while inhibited */
         break;
     }
 }
 
 static void destroy(void) {
-    idle_client_destroy(client);
-    if (slot) {
-        slot = sd_bus_slot_unref(slot);
-    }
+    /* Release our threshold: on_new_idle() must not be called anymore */
+    idler_deregister(idler_id);
+    idler_id = -1;
 }
 
-static int on_new_idle(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
-    int idle;
-    
+static void on_new_idle(bool idle) {
     /* Unused in requests! */
     display_req.display.old = state.display_state;
-    sd_bus_message_read(m, "b", &idle);
     if (idle) {
         display_req.display.new = DISPLAY_DIMMED;
     } else {
         display_req.display.new = DISPLAY_ON;
     }
     M_PUB(&display_req);
-    return 0;
 }
 
 /* Reset dimmer timeout */
 static void upower_timeout_callback(void) {
-    idle_set_timeout(client, conf.dimmer_timeout[state.ac_state]);
+    idler_set_timeout(idler_id, conf.dimmer_timeout[state.ac_state]);
 }
 
 /*
- * If we're getting inhibited, stop idle client.
- * Else, restart it.
+ * IDLER stops its idle client while inhibited;
+ * just track inhibition state.
  */
 static void inhibit_callback(void) {
     if (!state.inhibited) {
         DEBUG("Being resumed.\n");
-        idle_client_start(client, conf.dimmer_timeout[state.ac_state]);
         m_unbecome();
     } else {
         DEBUG("Being paused.\n");
-        idle_client_stop(client);
         m_become(inhibited);
     }
 }
@@ -1,17 +1,26 @@
-#include "bus.h"
+#include <inttypes.h>
+#include "mirror.h"
 
-static void dim_backlight(const double pct);
-static void restore_backlight(const double pct);
-static void publish_bl_req(const double pct, const bool smooth, const double step, const int to);
+static void dim_backlight(const double pct, const struct timespec *idle_ts);
+static void restore_backlight(const double pct, const struct timespec *idle_ts);
+static void set_backlight(const double pct, enum dim_trans trans, const struct timespec *idle_ts);
+static void record_latency(enum dim_trans trans, const struct timespec *idle_ts);
+static void bl_callback(const bl_upd *up);
 static void set_dpms(bool enable);
 
 DECLARE_MSG(display_msg, DISPLAY_UPD);
 DECLARE_MSG(bl_req, BL_REQ);
 
+/* Last dim/restore BL_REQ whose latency is traced until BACKLIGHT applies it */
+static enum dim_trans traced_trans;
+static struct timespec traced_ts;
+static double traced_pct = -1.0;
+
 MODULE("DISPLAY");
 
 static void init(void) {
     M_SUB(DISPLAY_REQ);
+    M_SUB(BL_UPD);
 }
 
 static bool check(void) {
@@ -29,12 +38,24 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     case DISPLAY_REQ: {
         display_upd *up = (display_upd *)MSG_DATA();
         if (VALIDATE_REQ(up)) {
+            /*
+             * Consume IDLER transition timestamp: only the first request following it
+             * comes from the transition; later ones (eg: from bus) find it zeroed,
+             * and are not accounted in latency histograms.
+             */
+            const struct timespec idle_ts = state.idle_ts;
+            state.idle_ts = (struct timespec){0};
+            
             display_msg.display.old = state.display_state;
             if (up->new == DISPLAY_DIMMED) {
                 state.display_state |= DISPLAY_DIMMED;
                 DEBUG("Entering dimmed state...\n");
-                old_pct = state.current_bl_pct;
-                dim_backlight(conf.dimmer_pct);
+                /*
+                 * Actual level, as it may have been changed by external tools;
+                 * if we are still ramping to a new level, restore that level instead.
+                 */
+                old_pct = mirror_get_target_bl();
+                dim_backlight(conf.dimmer_pct, &idle_ts);
             } else if (up->new == DISPLAY_OFF) {
                 state.display_state |= DISPLAY_OFF;
                 DEBUG("Entering dpms state...\n");
@@ -49,7 +70,7 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
                     state.display_state &= ~DISPLAY_DIMMED;
                     DEBUG("Leaving dimmed state...\n");
                     if (old_pct >= 0.0) {
-                        restore_backlight(old_pct);
+                        restore_backlight(old_pct, &idle_ts);
                         old_pct = -1.0;
                     }
                 }
@@ -59,6 +80,9 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
         }
         break;
     }
+    case BL_UPD:
+        bl_callback((bl_upd *)MSG_DATA());
+        break;
     default:
         break;
     }
@@ -68,26 +92,61 @@ static void destroy(void) {
 
 }
 
-static void dim_backlight(const double pct) {
+static void dim_backlight(const double pct, const struct timespec *idle_ts) {
     /* Don't touch backlight if a lower level is already set */
-    if (pct >= state.current_bl_pct) {
+    if (pct >= mirror_get_bl()) {
         DEBUG("A lower than dimmer_pct backlight level is already set. Avoid changing it.\n");
     } else {
-        publish_bl_req(pct, !conf.no_smooth_dimmer[ENTER], conf.dimmer_trans_step[ENTER], conf.dimmer_trans_timeout[ENTER]);
+        set_backlight(pct, ENTER, idle_ts);
     }
 }
 
 /* restore previous backlight level */
-static void restore_backlight(const double pct) {
-    publish_bl_req(pct, !conf.no_smooth_dimmer[EXIT], conf.dimmer_trans_step[EXIT], conf.dimmer_trans_timeout[EXIT]);
+static void restore_backlight(const double pct, const struct timespec *idle_ts) {
+    set_backlight(pct, EXIT, idle_ts);
 }
 
-static void publish_bl_req(const double pct, const bool smooth, const double step, const int to) {
+/*
+ * BL_REQ is applied by BACKLIGHT, in order with any other queued request:
+ * its latency is recorded once BACKLIGHT signals the new level through BL_UPD.
+ */
+static void set_backlight(const double pct, enum dim_trans trans, const struct timespec *idle_ts) {
     bl_req.bl.new = pct;
-    bl_req.bl.smooth = smooth;
-    bl_req.bl.step = step;
-    bl_req.bl.timeout = to;
+    bl_req.bl.smooth = !conf.no_smooth_dimmer[trans];
+    bl_req.bl.step = conf.dimmer_trans_step[trans];
+    bl_req.bl.timeout = conf.dimmer_trans_timeout[trans];
     M_PUB(&bl_req);
+    
+    /* Requests not following an idle transition (eg: from bus) are not traced */
+    traced_pct = idle_ts->tv_sec != 0 || idle_ts->tv_nsec != 0 ? pct : -1.0;
+    traced_trans = trans;
+    traced_ts = *idle_ts;
+}
+
+/* Other BL_UPDs (eg: from captures) may be received before the traced one */
+static void bl_callback(const bl_upd *up) {
+    if (traced_pct >= 0.0 && up->new == traced_pct) {
+        record_latency(traced_trans, &traced_ts);
+        traced_pct = -1.0;
+    }
+}
+
+/* Store ms elapsed since IDLER idle/active transition in its log2 histogram bucket */
+static void record_latency(enum dim_trans trans, const struct timespec *idle_ts) {
+    if (idle_ts->tv_sec == 0 && idle_ts->tv_nsec == 0) {
+        return;
+    }
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const uint64_t ms = (now.tv_sec - idle_ts->tv_sec) * 1000 + (now.tv_nsec - idle_ts->tv_nsec) / 1000000;
+    
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && ms >= (1ull << bucket)) {
+        bucket++;
+    }
+    state.display_latency[trans][bucket]++;
+    DEBUG("Backlight %s %" PRIu64 "ms after idle transition.\n", trans == ENTER ? "dimmed" : "restored", ms);
 }
 
 static void set_dpms(bool enable) {
@@ -1,21 +1,47 @@
 #include "my_math.h"
-#include "bus.h"
+#include "sleep.h"
 
-#define GAMMA_LONG_TRANS_TIMEOUT 10         // 10s between each step with slow transitioning
+#define GAMMA_JND_MIRED 5.5                 // just noticeable color temperature difference, in mireds
+#define GAMMA_MAX_SCHED_STEPS 400           // enough for 2 transitions between 1000K and 10000K, JND spaced
+#define GAMMA_SIGMOID_SLOPE 8.0             // steepness of sigmoid long transition curve
+#define GAMMA_AMBIENT_BUCKET 100            // ambient gamma temperatures are quantized in 100K buckets
+#define GAMMA_AMBIENT_HYST 0.25             // fraction of a bucket backlight must move past bucket edge to change bucket
+#define GAMMA_AMBIENT_SETTLE 2              // seconds without new backlight updates before setting ambient gamma temp
+#define GAMMA_RECHECK_TIMEOUT 3600          // seconds before checking again when next event is missing (eg: polar day/night)
+#define GAMMA_DRIFT_TOLERANCE 100           // Gamma.Get reconstructs temp from gamma ramps: smaller differences are not drifts
 
 static void check_gamma(void);
 static void get_gamma_events(const time_t *now, const float lat, const float lon, int day);
 static void check_next_event(const time_t *now);
 static void check_state(const time_t *now);
 static void set_temp(int temp, const time_t *now, int smooth, int step, int timeout);
+static void apply_temp(int temp, int smooth, int step, int timeout);
+static void build_schedule(void);
+static double curve_inverse(double y);
+static void walk_schedule(const time_t *now);
+static bool is_applied(int temp);
+static bool has_drifted(void);
+static bool in_transition(void);
 static void ambient_callback(void);
+static void set_ambient_temp(void);
 static void reset_gamma(void);
 static void interface_callback(temp_upd *req);
+static void display_callback(const display_upd *up);
+static void recompute_events(void);
+static void suspend_callback(void);
+static void resume_callback(void);
 
 static enum day_events target_event;           // which event are we targeting?
 static int event_time_range;                   // variable that holds minutes in advance/after an event to enter/leave EVENT state
 static bool long_transitioning;                // are we inside a long transition?
 static int gamma_fd;
+static int sleep_id = -1;
+static int sched_fd;                           // timer walking long transition schedule
+static int ambient_fd;                         // settle timer used to coalesce ambient gamma backlight updates
+static int ambient_bucket = -1;                // current ambient gamma temperature bucket
+static int applied_temp = -1;                  // last temp successfully set through clightd (-1 -> resync needed)
+static char applied_display[PATH_MAX + 1];     // display applied_temp was set on
+static struct timespec transition_end;         // CLOCK_MONOTONIC time at which last smooth transition is expected to end
 
 DECLARE_MSG(time_msg, DAYTIME_UPD);
 DECLARE_MSG(in_ev_msg, IN_EVENT_UPD);
@@ -23,6 +49,17 @@ DECLARE_MSG(sunrise_msg, SUNRISE_UPD);
 DECLARE_MSG(sunset_msg, SUNSET_UPD);
 DECLARE_MSG(temp_msg, TEMP_UPD);
 
+/*
+ * Day-long schedule of long transition steps: each step is
+ * a just noticeable temperature change away from previous one.
+ */
+static struct {
+    time_t time;
+    int temp;
+    enum day_events event;
+} schedule[GAMMA_MAX_SCHED_STEPS];
+static int sched_len;
+
 MODULE("GAMMA");
 
 static void init(void) {
@@ -42,12 +79,23 @@ static void init(void) {
     } else {
         M_SUB(BL_UPD);
         M_SUB(LOC_UPD);
+        M_SUB(DISPLAY_UPD);
+        M_SUB(SUSPEND_UPD);
+        M_SUB(RESUME_UPD);
+        sleep_id = sleep_register();
         M_SUB(TEMP_REQ);
         M_SUB(SUNRISE_REQ);
         M_SUB(SUNSET_REQ);
 
-        gamma_fd = start_timer(CLOCK_BOOTTIME, 0, 1);
+        /* Event timers are absolute wall clock times: get notified of any clock change */
+        gamma_fd = start_timer(CLOCK_REALTIME, 0, 1);
         m_register_fd(gamma_fd, true, NULL);
+        
+        ambient_fd = start_timer(CLOCK_BOOTTIME, 0, 0);
+        m_register_fd(ambient_fd, true, NULL);
+        
+        sched_fd = start_timer(CLOCK_REALTIME, 0, 0);
+        m_register_fd(sched_fd, true, NULL);
     }
 }
 
@@ -63,14 +111,33 @@ static bool evaluate(void) {
 }
 
 static void destroy(void) {
-
+    sleep_deregister(sleep_id);
 }
 
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
     case FD_UPD:
-        read_timer(msg->fd_msg->fd);
-        check_gamma();
+        if (read_timer(msg->fd_msg->fd) == -1) {
+            if (errno == ECANCELED) {
+                /*
+                 * Wall clock changed (eg: NTP adjustment, timezone or DST change): recompute everything now.
+                 * Both gamma_fd and sched_fd get cancelled: disarm both, so that
+                 * the other one does not trigger a second recompute, then let recompute_events() re-arm them.
+                 */
+                INFO("System clock changed. Updating sunrise and sunset times.\n");
+                set_timeout(0, 0, gamma_fd, 0);
+                set_timeout(0, 0, sched_fd, 0);
+                recompute_events();
+            }
+            /* Otherwise (EAGAIN), timer was already re-armed after a clock change: nothing to do */
+        } else if (msg->fd_msg->fd == ambient_fd) {
+            set_ambient_temp();
+        } else if (msg->fd_msg->fd == sched_fd) {
+            const time_t t = time(NULL);
+            walk_schedule(&t);
+        } else {
+            check_gamma();
+        }
         break;
     case LOC_UPD:
         reset_gamma();
@@ -79,6 +146,15 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     case BL_UPD:
         ambient_callback();
         break;
+    case DISPLAY_UPD:
+        display_callback((display_upd *)MSG_DATA());
+        break;
+    case SUSPEND_UPD:
+        suspend_callback();
+        break;
+    case RESUME_UPD:
+        resume_callback();
+        break;
     case SUNSET_REQ:
     case SUNRISE_REQ: {
         evt_upd *up = (evt_upd *)MSG_DATA();
@@ -113,13 +189,14 @@ static void check_gamma(void) {
     const enum day_events old_target_event = target_event; 
     
     /*
-     * get_gamma_events will always poll today events. It should not be necessary,
-     * (as it will normally only be needed to get new events for tomorrow, once clight is started)
-     * but if, for example, laptop gets suspended at evening, before computing next day events,
-     * and it is waken next morning, it will proceed to compute "tomorrow" events, where tomorrow is
-     * the wrong day (it should compute "today" events). Thus, avoid this kind of issues.
+     * Events only need to be computed once today's last one is over.
+     * Clock changes and resume from suspend force a recompute through recompute_events().
      */
-    get_gamma_events(&t, state.current_loc.lat, state.current_loc.lon, 0);
+    if (t >= state.day_events[SUNSET] + conf.event_duration) {
+        get_gamma_events(&t, state.current_loc.lat, state.current_loc.lon, 0);
+    }
+    check_next_event(&t);
+    check_state(&t);
     
     struct tm tm_now, tm_old;
     localtime_r(&t, &tm_now);
@@ -161,92 +238,97 @@ static void check_gamma(void) {
     /**                                 **/
 
     /*
-     * Forcefully set correct gamma every time
-     * to avoid any possible sync issue
-     * between time of day and gamma (eg after long suspend).
+     * Avoid any possible sync issue between time of day and gamma
+     * (eg after a long suspend, or if anything else changed screen temperature)
+     * by forcing a resync; otherwise set_temp() will skip redundant sets.
+     * Only check for drifts when the set would be skipped: a new temp is set anyway.
      * For long_transitioning, only call it when starting transition,
      * and at the end (to be sure to correctly set desired gamma and to avoid any sync issue)
      */
-    if (!long_transitioning && !conf.ambient_gamma) {
+    if (!long_transitioning && !conf.ambient_gamma && !(state.display_state & DISPLAY_OFF)) {
+        if (is_applied(conf.temp[state.day_time]) && has_drifted()) {
+            applied_temp = -1;
+        }
         set_temp(conf.temp[state.day_time], &t, !conf.no_smooth_gamma, conf.gamma_trans_step, conf.gamma_trans_timeout);
     }
 
-    /* desired gamma temp has been set. Set new GAMMA timer */
+    /* 
+     * desired gamma temp has been set. Set new GAMMA timer.
+     * Near polar circles, target event may be missing (-1):
+     * there is nothing to wait for, thus just check again later.
+     */
     const time_t next = state.day_events[target_event] + event_time_range;
-    INFO("Next alarm due to: %s", ctime(&next));
-    set_timeout(next - t, 0, gamma_fd, 0);
+    if (state.day_events[target_event] != -1 && set_abs_timeout(next, gamma_fd) == 0) {
+        INFO("Next alarm due to: %s", ctime(&next));
+    } else {
+        INFO("No next event found. Checking again in %d minutes.\n", GAMMA_RECHECK_TIMEOUT / 60);
+        set_timeout(GAMMA_RECHECK_TIMEOUT, 0, gamma_fd, 0);
+    }
 
     last_t = t;
 }
 
 /*
  * day -> will be 0 first time this func is called, else 1 (tomorrow).
- * Stores day sunrise/sunset events only if this is first time it is called,
- * or of today's sunset event is finished.
- * Firstly computes day's sunrise and sunset; then calls check_next_event and check_state to
- * update next_event and state.time variables according to new state.
- * Note that "+1" is because it seems timerfd receives timer end circa 1s in advance.
- * Probably it is just some ms in advance, but rounding it to seconds returns 1s in advance.
+ * Called once today's sunset event is finished (or events were reset):
+ * computes day's sunrise and sunset, moving on to tomorrow if today's ones are over.
  */
 static void get_gamma_events(const time_t *now, const float lat, const float lon, int day) {
     time_t t;
     const time_t old_events[SIZE_EVENTS] = { state.day_events[SUNRISE], state.day_events[SUNSET] };
 
-    /* only every new day, after today's last event (ie: sunset + event_duration) */
-    if (*now + 1 >= state.day_events[SUNSET] + conf.event_duration) {
-        if (calculate_sunset(lat, lon, &t, day) == 0) {
-            /* If today's sunset was before now, compute tomorrow */
-            if (*now + 1 >= t + conf.event_duration) {
-                /*
-                 * we're between today's sunset and tomorrow sunrise.
-                 * rerun function with tomorrow.
-                 */
-                return get_gamma_events(now, lat, lon, ++day);
-            }
-            state.day_events[SUNSET] = t;
-        } else {
-            state.day_events[SUNSET] = -1;
-        }
-
-        if (calculate_sunrise(lat, lon, &t, day) == 0) {
+    if (calculate_sunset(lat, lon, &t, day) == 0) {
+        /* If today's sunset was before now, compute tomorrow */
+        if (*now >= t + conf.event_duration) {
             /*
-             * Force computation of today event if SUNRISE is
-             * not today; eg: in local time it is at 6am, but utc time is 22,
-             * so it counts as today while it is indeed tomorrow...
+             * we're between today's sunset and tomorrow sunrise.
+             * rerun function with tomorrow.
              */
-            if (t > state.day_events[SUNSET]) {
-                calculate_sunrise(lat, lon, &t, day - 1);
-            }
-            
-            state.day_events[SUNRISE] = t;
-        } else {
-            state.day_events[SUNRISE] = -1;
+            return get_gamma_events(now, lat, lon, ++day);
         }
+        state.day_events[SUNSET] = t;
+    } else {
+        state.day_events[SUNSET] = -1;
+    }
 
-        if (state.day_events[SUNRISE] == -1 && state.day_events[SUNSET] == -1) {
-            /*
-             * no sunrise/sunset could be found.
-             * Assume day and set sunset 12hrs from now
-             */
-            state.day_events[SUNSET] = *now + 12 * 60 * 60;
-            WARN("Failed to retrieve sunrise/sunset informations.\n");
+    if (calculate_sunrise(lat, lon, &t, day) == 0) {
+        /*
+         * Force computation of today event if SUNRISE is
+         * not today; eg: in local time it is at 6am, but utc time is 22,
+         * so it counts as today while it is indeed tomorrow...
+         */
+        if (t > state.day_events[SUNSET]) {
+            calculate_sunrise(lat, lon, &t, day - 1);
         }
         
-        sunrise_msg.event.old = old_events[SUNRISE];
-        sunrise_msg.event.new = state.day_events[SUNRISE];
-        M_PUB(&sunrise_msg);
-        
-        sunset_msg.event.old = old_events[SUNSET];
-        sunset_msg.event.new = state.day_events[SUNSET];
-        M_PUB(&sunset_msg);
+        state.day_events[SUNRISE] = t;
+    } else {
+        state.day_events[SUNRISE] = -1;
     }
-    check_next_event(now);
-    check_state(now);
+
+    if (state.day_events[SUNRISE] == -1 && state.day_events[SUNSET] == -1) {
+        /*
+         * no sunrise/sunset could be found.
+         * Assume day and set sunset 12hrs from now
+         */
+        state.day_events[SUNSET] = *now + 12 * 60 * 60;
+        WARN("Failed to retrieve sunrise/sunset informations.\n");
+    }
+    
+    sunrise_msg.event.old = old_events[SUNRISE];
+    sunrise_msg.event.new = state.day_events[SUNRISE];
+    M_PUB(&sunrise_msg);
+    
+    sunset_msg.event.old = old_events[SUNSET];
+    sunset_msg.event.new = state.day_events[SUNSET];
+    M_PUB(&sunset_msg);
+    
+    build_schedule();
 }
 
 /*
  * Updates next_event global var, according to now time_t value.
- * Note that "+1" is because it seems timerfd receives timer end circa 1s in advance.
+ * As event timers are absolute, now is never before the event time they were armed for.
  */
 static void check_next_event(const time_t *now) {
     /*
@@ -254,17 +336,16 @@ static void check_next_event(const time_t *now) {
      * We're after state.events[SUNSET] (when clight is started between SUNSET)
      * We're before state.events[SUNRISE] (when clight is started before today's SUNRISE)
      */
-    if (*now + 1 > state.day_events[SUNSET] || *now + 1 < state.day_events[SUNRISE]) {
+    if (*now >= state.day_events[SUNSET] || *now < state.day_events[SUNRISE]) {
         state.day_time = NIGHT;
     } else {
         state.day_time = DAY;
     }
-    target_event = (*now + 1 < (state.day_events[SUNRISE] + conf.event_duration)) ? SUNRISE : SUNSET;    
+    target_event = (*now < (state.day_events[SUNRISE] + conf.event_duration)) ? SUNRISE : SUNSET;
 }
 
 /*
  * Updates state.time global var, according to now time_t value.
- * Note that "+1" is because it seems timerfd receives timer end circa 1s in advance.
  * If we're inside an event, checks which side of the events we're in
  * (to understand which conf.temp is correct for this state).
  * Then sets event_time_range accordingly; ie: 30mins before event, if we're not inside an event;
@@ -272,8 +353,8 @@ static void check_next_event(const time_t *now) {
  * 30mins after event to remove EVENT state.
  */
 static void check_state(const time_t *now) {
-    if (labs(state.day_events[target_event] - (*now + 1)) <= conf.event_duration) {
-        if (state.day_events[target_event] > *now + 1) {
+    if (labs(state.day_events[target_event] - *now) <= conf.event_duration) {
+        if (state.day_events[target_event] > *now) {
             event_time_range = 0; // next timer is on next_event
         } else {
             event_time_range = conf.event_duration; // next timer is when leaving event
@@ -287,35 +368,51 @@ static void check_state(const time_t *now) {
 }
 
 static void set_temp(int temp, const time_t *now, int smooth, int step, int timeout) {
-    int ok;
+    /* Walk long transition schedule (if outside of event, fallback to normal transition) */
+    if (conf.gamma_long_transition && now && state.in_event) {
+        walk_schedule(now);
+        return;
+    }
     
-    SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Set");
+    if (long_transitioning) {
+        long_transitioning = false;
+        set_timeout(0, 0, sched_fd, 0);
+    }
     
-    /* Compute long transition steps and timeouts (if outside of event, fallback to normal transition) */
-    if (conf.gamma_long_transition && now && state.in_event) {
-        smooth = 1;
-        if (event_time_range == 0) {
-            /* Remaining time in first half + second half of transition */
-            timeout = (state.day_events[target_event] - *now) + conf.event_duration;
-            temp = conf.temp[!state.day_time]; // use correct temp, ie the one for next event
-        } else {
-            /* Remaining time in second half of transition */
-            timeout = conf.event_duration - (*now - state.day_events[target_event]);
-        }
-        /* Temperature difference */
-        step = abs(conf.temp[DAY] - conf.temp[NIGHT]);        
-        /* Compute each step size with a gamma_trans_timeout of 10s */
-        step /= (((double)timeout) / GAMMA_LONG_TRANS_TIMEOUT);
-        /* force gamma_trans_timeout to 10s (in ms) */
-        timeout = GAMMA_LONG_TRANS_TIMEOUT * 1000;
-        
-        long_transitioning = true;
+    if (is_applied(temp)) {
+        state.gamma_skipped_sets++;
+        DEBUG("%d gamma temp already set; skipping.\n", temp);
+        return;
+    }
+    
+    apply_temp(temp, smooth, step, timeout);
+    if (!smooth) {
+        INFO("%d gamma temp set.\n", temp);
     } else {
-        long_transitioning = false;
+        INFO("Normal transition to %d gamma temp started.\n", temp);
     }
+}
+
+static void apply_temp(int temp, int smooth, int step, int timeout) {
+    int ok;
+    
+    SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Set");
     
     int r = call(&ok, "b", &args, "ssi(buu)", state.display, state.xauthority, temp, smooth, step, timeout);
     if (!r && ok) {
+        clock_gettime(CLOCK_MONOTONIC, &transition_end);
+        if (smooth && step > 0) {
+            /* Clightd moves temp by step every timeout ms */
+            const long ms = (long)ceil(abs(temp - state.current_temp) / (double)step) * timeout;
+            transition_end.tv_sec += ms / 1000;
+            transition_end.tv_nsec += (ms % 1000) * 1000000;
+            if (transition_end.tv_nsec >= 1000000000) {
+                transition_end.tv_sec++;
+                transition_end.tv_nsec -= 1000000000;
+            }
+        }
+        applied_temp = temp;
+        strncpy(applied_display, state.display, PATH_MAX);
         temp_msg.temp.old = state.current_temp;
         state.current_temp = temp;
         temp_msg.temp.new = state.current_temp;
@@ -324,25 +421,171 @@ static void set_temp(int temp, const time_t *now, int smooth, int step, int time
         temp_msg.temp.timeout = timeout;
         temp_msg.temp.daytime = state.day_time;
         M_PUB(&temp_msg);
-        if (!long_transitioning && conf.no_smooth_gamma) {
-            INFO("%d gamma temp set.\n", temp);
+    }
+}
+
+/*
+ * Precompute long transition steps for today's events.
+ * Color temperature differences are perceived roughly uniformly in mireds (1e6 / K),
+ * thus each transition is split in steps of GAMMA_JND_MIRED mireds,
+ * each one scheduled when transition curve reaches its midpoint.
+ * This way only visible changes are ever written.
+ */
+static void build_schedule(void) {
+    sched_len = 0;
+    
+    for (enum day_events ev = SUNRISE; ev < SIZE_EVENTS; ev++) {
+        if (state.day_events[ev] <= 0) {
+            continue;
+        }
+        
+        const int from = conf.temp[ev == SUNRISE ? NIGHT : DAY];
+        const int to = conf.temp[ev == SUNRISE ? DAY : NIGHT];
+        const double m_from = 1000000.0 / from;
+        const double m_diff = 1000000.0 / to - m_from;
+        const time_t start = state.day_events[ev] - conf.event_duration;
+        
+        int num_steps = ceil(fabs(m_diff) / GAMMA_JND_MIRED);
+        if (num_steps == 0) {
+            num_steps = 1;
+        }
+        if (sched_len + num_steps > GAMMA_MAX_SCHED_STEPS) {
+            num_steps = GAMMA_MAX_SCHED_STEPS - sched_len;
+        }
+        
+        for (int k = 1; k <= num_steps; k++) {
+            const double p = curve_inverse((k - 0.5) / num_steps);
+            schedule[sched_len].time = start + lround(p * 2 * conf.event_duration);
+            schedule[sched_len].temp = k == num_steps ? to : lround(1000000.0 / (m_from + m_diff * k / num_steps));
+            schedule[sched_len].event = ev;
+            sched_len++;
+        }
+    }
+    DEBUG("Long transition schedule built with %d steps.\n", sched_len);
+}
+
+/*
+ * Inverse of long transition curve: given transition progress y in [0, 1]
+ * (in mireds), return the fraction of transition time at which it is reached.
+ */
+static double curve_inverse(double y) {
+    if (conf.gamma_trans_curve == SIGMOID_CURVE) {
+        const double a = 1.0 / (1.0 + exp(GAMMA_SIGMOID_SLOPE / 2));
+        const double v = a + y * (1.0 - 2 * a);
+        return 0.5 + log(v / (1.0 - v)) / GAMMA_SIGMOID_SLOPE;
+    }
+    return y;
+}
+
+/*
+ * Set the schedule step due now for current transition,
+ * then arm sched_fd on next one; a single timer thus walks the whole transition.
+ * When entering schedule mid-transition, reach the due step smoothly.
+ */
+static void walk_schedule(const time_t *now) {
+    int temp = conf.temp[target_event == SUNRISE ? NIGHT : DAY];
+    int next = -1;
+    
+    for (int i = 0; i < sched_len; i++) {
+        if (schedule[i].event == target_event) {
+            if (schedule[i].time > *now) {
+                next = i;
+                break;
+            }
+            temp = schedule[i].temp;
+        }
+    }
+    
+    if (!is_applied(temp)) {
+        if (long_transitioning) {
+            apply_temp(temp, false, 0, 0);
         } else {
-            INFO("%s transition to %d gamma temp started.\n", long_transitioning ? "Long" : "Normal", temp);
+            apply_temp(temp, !conf.no_smooth_gamma, conf.gamma_trans_step, conf.gamma_trans_timeout);
+            INFO("Long transition to %d gamma temp started.\n", conf.temp[target_event == SUNRISE ? DAY : NIGHT]);
         }
     }
+    
+    /* On failure, GAMMA timer will set final temp when leaving the event */
+    long_transitioning = next != -1 && set_abs_timeout(schedule[next].time, sched_fd) == 0;
+}
+
+/* Whether temp is already set on current display, and no resync is needed */
+static bool is_applied(int temp) {
+    return applied_temp == temp && !strcmp(applied_display, state.display);
 }
 
+/*
+ * Verify that screen temperature is still the one we set,
+ * ie: no one else changed it behind our back.
+ * Gamma.Get is a simple read, way cheaper than a (smooth) Gamma.Set.
+ * It is approximated from gamma ramps, and it returns intermediate values
+ * while a transition is ongoing: skip the check meanwhile.
+ */
+static bool has_drifted(void) {
+    int temp;
+    
+    if (applied_temp == -1 || long_transitioning || in_transition()) {
+        return false;
+    }
+    SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Get");
+    int r = call(&temp, "i", &args, "ss", state.display, state.xauthority);
+    if (r || abs(temp - applied_temp) > GAMMA_DRIFT_TOLERANCE) {
+        DEBUG("Gamma temp drifted from %d to %d; resyncing.\n", applied_temp, temp);
+        return true;
+    }
+    return false;
+}
+
+static bool in_transition(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec < transition_end.tv_sec || 
+           (now.tv_sec == transition_end.tv_sec && now.tv_nsec < transition_end.tv_nsec);
+}
+
+/*
+ * Ambient gamma follows backlight level; ignore updates
+ * coming from DISPLAY dimming, as they do not reflect ambient brightness
+ * (when leaving dimmed state, backlight is restored to a level in the same bucket).
+ * Bursts of updates (eg: consecutive recalibrations) are coalesced
+ * by (re)arming a settle timer; temp is only set once it expires.
+ */
 static void ambient_callback(void) {
-    if (conf.ambient_gamma) {
-        /* 
-         * Note that conf.temp is not constant (it can be changed through bus api),
-         * thus we have to always compute these ones.
-         */
-        const int diff = abs(conf.temp[DAY] - conf.temp[NIGHT]);
-        const int min_temp = conf.temp[NIGHT] < conf.temp[DAY] ? conf.temp[NIGHT] : conf.temp[DAY]; 
-        const int ambient_temp = (diff * state.current_bl_pct) + min_temp;
-        set_temp(ambient_temp, NULL, !conf.no_smooth_gamma, conf.gamma_trans_step, conf.gamma_trans_timeout); // force refresh (passing NULL time_t*)
+    if (conf.ambient_gamma && !state.display_state) {
+        set_timeout(GAMMA_AMBIENT_SETTLE, 0, ambient_fd, 0);
+    }
+}
+
+/*
+ * Map backlight level to a quantized temperature bucket.
+ * Hysteresis avoids flapping between neighbouring buckets
+ * when backlight level sits near a bucket edge.
+ */
+static void set_ambient_temp(void) {
+    if (!conf.ambient_gamma || state.display_state) {
+        return;
+    }
+    
+    /* 
+     * Note that conf.temp is not constant (it can be changed through bus api),
+     * thus we have to always compute these ones.
+     */
+    const int diff = abs(conf.temp[DAY] - conf.temp[NIGHT]);
+    const int min_temp = conf.temp[NIGHT] < conf.temp[DAY] ? conf.temp[NIGHT] : conf.temp[DAY]; 
+    const double bucket = (diff * state.current_bl_pct) / GAMMA_AMBIENT_BUCKET;
+    
+    if (ambient_bucket != -1 && 
+        bucket > ambient_bucket - GAMMA_AMBIENT_HYST && bucket < ambient_bucket + 1 + GAMMA_AMBIENT_HYST) {
+        DEBUG("Ambient gamma bucket unchanged.\n");
+        return;
     }
+    ambient_bucket = floor(bucket);
+    
+    int ambient_temp = ambient_bucket * GAMMA_AMBIENT_BUCKET + min_temp;
+    if (ambient_temp > min_temp + diff) {
+        ambient_temp = min_temp + diff;
+    }
+    set_temp(ambient_temp, NULL, !conf.no_smooth_gamma, conf.gamma_trans_step, conf.gamma_trans_timeout); // force refresh (passing NULL time_t*)
 }
 
 static void reset_gamma(void) {
@@ -353,7 +596,67 @@ static void reset_gamma(void) {
 
 static void interface_callback(temp_upd *req) {
     conf.temp[req->daytime] = req->new;
+    build_schedule();
+    ambient_bucket = -1; // buckets depend on conf.temp: force next ambient gamma update to recompute it
     if (!conf.ambient_gamma && req->daytime == state.day_time) {
         set_temp(conf.temp[req->daytime], NULL, req->smooth, req->step, req->timeout); // force refresh (passing NULL time_t*)
     }
 }
+
+/*
+ * While display is off, nobody can see screen temperature:
+ * stop any long transition; check_gamma() will skip setting temp too.
+ * When display is back on, directly apply the correct temperature in one step.
+ */
+static void display_callback(const display_upd *up) {
+    if ((up->new & DISPLAY_OFF) && !(up->old & DISPLAY_OFF)) {
+        if (long_transitioning) {
+            DEBUG("Pausing long transition while display is off.\n");
+            long_transitioning = false;
+            set_timeout(0, 0, sched_fd, 0);
+        }
+    } else if (!(up->new & DISPLAY_OFF) && (up->old & DISPLAY_OFF) && !conf.ambient_gamma) {
+        if (conf.gamma_long_transition && state.in_event) {
+            /* Resume walking long transition schedule from the step due now, without smoothing */
+            const time_t t = time(NULL);
+            long_transitioning = true;
+            walk_schedule(&t);
+        } else {
+            set_temp(conf.temp[state.day_time], NULL, false, 0, 0);
+        }
+    }
+}
+
+/*
+ * Events and schedule times are wall clock based:
+ * on clock changes or resume, recompute today's events and reposition any long transition.
+ */
+static void recompute_events(void) {
+    state.day_events[SUNSET] = 0; // to force get_gamma_events to recheck sunrise and sunset for today
+    check_gamma();
+    if (long_transitioning) {
+        const time_t t = time(NULL);
+        walk_schedule(&t);
+    }
+}
+
+/* Nothing to do while sleeping: disarm all timers */
+static void suspend_callback(void) {
+    set_timeout(0, 0, gamma_fd, 0);
+    set_timeout(0, 0, sched_fd, 0);
+    set_timeout(0, 0, ambient_fd, 0);
+    long_transitioning = false;
+    sleep_ack(sleep_id);
+}
+
+/*
+ * Screen temperature may have been reset while sleeping (eg: by a VT switch):
+ * force a resync and recompute events, as they may have changed meanwhile.
+ */
+static void resume_callback(void) {
+    applied_temp = -1;
+    if (conf.ambient_gamma) {
+        ambient_bucket = -1;
+    }
+    recompute_events();
+}
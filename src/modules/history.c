@@ -0,0 +1,64 @@
+#include <sys/stat.h>
+#include "bus.h"
+#include "series.h"
+
+static void init_history_file(char *filename);
+
+MODULE("HISTORY");
+
+static void init(void) {
+    char history_file[PATH_MAX + 1] = {0};
+    init_history_file(history_file);
+    if (series_open(history_file, conf.history_size) == 0) {
+        M_SUB(AMBIENT_BR_UPD);
+        M_SUB(BL_UPD);
+        M_SUB(TEMP_UPD);
+        M_SUB(SCR_BL_UPD);
+    } else {
+        WARN("Failed to init.\n");
+        m_poisonpill(self());
+    }
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return conf.history_size > 0;
+}
+
+static void destroy(void) {
+    series_close();
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    const enum mod_msg_types type = MSG_TYPE();
+    switch (type) {
+    case AMBIENT_BR_UPD:
+    case BL_UPD:
+    case SCR_BL_UPD: {
+        bl_upd *up = (bl_upd *)MSG_DATA();
+        series_append(type, time(NULL), up->new);
+        break;
+    }
+    case TEMP_UPD: {
+        temp_upd *up = (temp_upd *)MSG_DATA();
+        series_append(type, time(NULL), up->new);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void init_history_file(char *filename) {
+    if (getenv("XDG_DATA_HOME")) {
+        snprintf(filename, PATH_MAX, "%s/clight/", getenv("XDG_DATA_HOME"));
+    } else {
+        snprintf(filename, PATH_MAX, "%s/.local/share/clight/", getpwuid(getuid())->pw_dir);
+    }
+    /* Create XDG_DATA_HOME/clight/ folder if it does not exist! */
+    mkdir(filename, 0755);
+    strncat(filename, "history.bin", PATH_MAX - strlen(filename));
+}
@@ -0,0 +1,363 @@
+#include "idler.h"
+
+#define IDLER_MAX_THRESHOLDS 4
+
+/*
+ * A single Clightd idle client is shared by every registered threshold:
+ * its timeout is the lowest registered one; higher thresholds
+ * are reached through an in-process timer, once the client signals idleness.
+ */
+typedef struct {
+    int timeout;                        // seconds of inactivity to be considered idle (<= 0 -> disabled)
+    idler_cb cb;                        // NULL -> free slot
+    bool idle;
+} threshold_t;
+
+static int idle_get_client(void);
+static int idle_hook_update(void);
+static int on_new_idle(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static void update_client(void);
+static int client_timeout(void);
+static void check_thresholds(void);
+static void set_active(void);
+static int client_set_timeout(int timeout);
+static int client_start(void);
+static int client_stop(void);
+static int client_destroy(void);
+static void inhibit_callback(void);
+static void simulate_callback(void);
+static void reset_client(void);
+
+static threshold_t thresholds[IDLER_MAX_THRESHOLDS];
+static int num_thresholds;              // highest used slot + 1
+static char client[PATH_MAX + 1];
+static int curr_timeout;                // timeout currently set on clightd client
+static sd_bus_slot *slot;
+static int idler_fd = -1;
+static struct timespec idle_since;      // when user became idle (valid while client signaled idleness)
+static bool client_idle;
+static int simulate_fd = -1;
+static struct timespec last_reset;      // last time clightd client was reset by a SIMULATE_REQ
+static bool reset_pending;              // whether a coalesced SIMULATE_REQ is waiting for simulate_fd
+static bool started;                    // whether init() was run, successfully or not
+static bool running;
+
+MODULE("IDLER");
+
+static void init(void) {
+    started = true;
+    int r = idle_get_client();
+    if (r == 0) {
+        r = idle_hook_update();
+    }
+    if (r == 0) {
+        M_SUB(INHIBIT_UPD);
+        M_SUB(SIMULATE_REQ);
+
+        idler_fd = start_timer(CLOCK_BOOTTIME, 0, 0);
+        m_register_fd(idler_fd, true, NULL);
+        simulate_fd = start_timer(CLOCK_BOOTTIME, 0, 0);
+        m_register_fd(simulate_fd, true, NULL);
+        running = true;
+    } else {
+        WARN("Clightd idle error.\n");
+        *client = '\0'; // reset client making it useless
+        m_poisonpill(self());
+    }
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return (!conf.no_dimmer || !conf.no_dpms) && state.ac_state != -1;
+}
+
+static void destroy(void) {
+    running = false;
+    client_destroy();
+    *client = '\0';
+    if (slot) {
+        slot = sd_bus_slot_unref(slot);
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD:
+        read_timer(msg->fd_msg->fd);
+        if (msg->fd_msg->fd == simulate_fd) {
+            /* Window elapsed: apply coalesced SIMULATE_REQs */
+            if (reset_pending && !state.inhibited) {
+                reset_client();
+            }
+            reset_pending = false;
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &state.idle_ts);
+            check_thresholds();
+        }
+        break;
+    case INHIBIT_UPD:
+        inhibit_callback();
+        break;
+    case SIMULATE_REQ: {
+        /* Validation is useless here; only for coherence */
+        if (VALIDATE_REQ((void *)msg->ps_msg->message) && !state.inhibited) {
+            simulate_callback();
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/*
+ * Whether IDLER already tried to start:
+ * clients should wait for it before calling idler_register().
+ */
+bool idler_started(void) {
+    return started;
+}
+
+/*
+ * Register a new idle threshold; cb will be called with true
+ * when user has been idle for timeout seconds, and with false when user is back active.
+ * Returns threshold id to be used with idler_set_timeout(),
+ * or -1 on error (eg: IDLER failed to start or was stopped).
+ */
+int idler_register(int timeout, idler_cb cb) {
+    if (!running || !cb) {
+        return -1;
+    }
+    int id = 0;
+    while (id < IDLER_MAX_THRESHOLDS && thresholds[id].cb) {
+        id++;
+    }
+    if (id == IDLER_MAX_THRESHOLDS) {
+        return -1;
+    }
+    thresholds[id].timeout = timeout;
+    thresholds[id].cb = cb;
+    thresholds[id].idle = false;
+    if (id == num_thresholds) {
+        num_thresholds++;
+    }
+    update_client();
+    return id;
+}
+
+void idler_set_timeout(int id, int timeout) {
+    if (id >= 0 && id < num_thresholds && thresholds[id].cb && thresholds[id].timeout != timeout) {
+        thresholds[id].timeout = timeout;
+        update_client();
+    }
+}
+
+/*
+ * Free a threshold slot, eg: when its module is stopped.
+ * Its callback won't be called anymore, not even to notify user is back active.
+ */
+void idler_deregister(int id) {
+    if (id >= 0 && id < num_thresholds && thresholds[id].cb) {
+        memset(&thresholds[id], 0, sizeof(threshold_t));
+        while (num_thresholds > 0 && !thresholds[num_thresholds - 1].cb) {
+            num_thresholds--;
+        }
+        update_client();
+    }
+}
+
+static int idle_get_client(void) {
+    SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Idle", "org.clightd.clightd.Idle", "GetClient");
+    return call(client, "o", &args, NULL);
+}
+
+static int idle_hook_update(void) {
+    SYSBUS_ARG(args, CLIGHTD_SERVICE, client, "org.clightd.clightd.Idle.Client", "Idle");
+    return add_match(&args, &slot, on_new_idle);
+}
+
+/* Callback on clightd client Idle signal */
+static int on_new_idle(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    int idle;
+
+    clock_gettime(CLOCK_MONOTONIC, &state.idle_ts);
+    sd_bus_message_read(m, "b", &idle);
+    if (idle) {
+        /* Client fires after curr_timeout seconds of inactivity */
+        clock_gettime(CLOCK_BOOTTIME, &idle_since);
+        idle_since.tv_sec -= curr_timeout;
+        client_idle = true;
+        check_thresholds();
+    } else {
+        set_active();
+    }
+    return 0;
+}
+
+/* Only touch clightd client when lowest threshold changed */
+static void update_client(void) {
+    if (strlen(client)) {
+        const int timeout = client_timeout();
+        if (timeout != curr_timeout) {
+            curr_timeout = timeout;
+            client_set_timeout(timeout);
+        }
+        if (client_idle) {
+            check_thresholds();
+        }
+    }
+}
+
+/* Lowest enabled threshold */
+static int client_timeout(void) {
+    int timeout = 0;
+    for (int i = 0; i < num_thresholds; i++) {
+        if (thresholds[i].timeout > 0 && (timeout == 0 || thresholds[i].timeout < timeout)) {
+            timeout = thresholds[i].timeout;
+        }
+    }
+    return timeout;
+}
+
+/*
+ * Notify every threshold reached by current idle time,
+ * then arm idler_fd for the next one, if any.
+ */
+static void check_thresholds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    const int elapsed = now.tv_sec - idle_since.tv_sec;
+
+    int next = 0;
+    for (int i = 0; i < num_thresholds; i++) {
+        if (thresholds[i].timeout <= 0 || thresholds[i].idle) {
+            continue;
+        }
+        if (thresholds[i].timeout <= elapsed) {
+            thresholds[i].idle = true;
+            thresholds[i].cb(true);
+        } else if (next == 0 || thresholds[i].timeout < next) {
+            next = thresholds[i].timeout;
+        }
+    }
+    if (next > 0) {
+        set_timeout(next - elapsed, 0, idler_fd, 0);
+    } else {
+        set_timeout(0, 0, idler_fd, 0);
+    }
+}
+
+/* User is back: notify idle thresholds, highest registered first */
+static void set_active(void) {
+    client_idle = false;
+    set_timeout(0, 0, idler_fd, 0);
+    for (int i = num_thresholds - 1; i >= 0; i--) {
+        if (thresholds[i].idle) {
+            thresholds[i].idle = false;
+            thresholds[i].cb(false);
+        }
+    }
+}
+
+static int client_set_timeout(int timeout) {
+    int r = 0;
+    if (timeout > 0) {
+        SYSBUS_ARG(to_args, CLIGHTD_SERVICE, client, "org.clightd.clightd.Idle.Client", "Timeout");
+        r = set_property(&to_args, 'u', &timeout);
+        if (!state.inhibited) {
+            /* Only start client if we are not inhibited */
+            r += client_start();
+        }
+    } else {
+        r = client_stop();
+    }
+    return r;
+}
+
+static int client_start(void) {
+    if (strlen(client) && curr_timeout > 0) {
+        SYSBUS_ARG(args, CLIGHTD_SERVICE, client, "org.clightd.clightd.Idle.Client", "Start");
+        return call(NULL, NULL, &args, NULL);
+    }
+    return 0;
+}
+
+static int client_stop(void) {
+    if (strlen(client)) {
+        SYSBUS_ARG(args, CLIGHTD_SERVICE, client, "org.clightd.clightd.Idle.Client", "Stop");
+        return call(NULL, NULL, &args, NULL);
+    }
+    return -1;
+}
+
+static int client_destroy(void) {
+    if (!strlen(client)) {
+        return -1;
+    }
+
+    /* Properly stop client */
+    client_stop();
+
+    SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Idle", "org.clightd.clightd.Idle", "DestroyClient");
+    return call(NULL, NULL, &args, "o", client);
+}
+
+/*
+ * If we're getting inhibited, stop idle client.
+ * Else, restart it.
+ */
+static void inhibit_callback(void) {
+    if (!state.inhibited) {
+        DEBUG("Being resumed.\n");
+        client_start();
+    } else {
+        DEBUG("Being paused.\n");
+        client_stop();
+        /* Stopped client won't tell us when user is back */
+        clock_gettime(CLOCK_MONOTONIC, &state.idle_ts);
+        set_active();
+        /* Client will be restarted anyway when inhibition is dropped */
+        reset_pending = false;
+        set_timeout(0, 0, simulate_fd, 0);
+    }
+}
+
+/*
+ * Apps (eg: video players) call SimulateUserActivity every few seconds.
+ * Reset the client at most once every conf.simulate_window seconds:
+ * requests received within the window are coalesced
+ * into a single reset, issued when the window elapses.
+ */
+static void simulate_callback(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    const int elapsed = now.tv_sec - last_reset.tv_sec;
+
+    if (conf.simulate_window <= 0 || elapsed >= conf.simulate_window) {
+        reset_client();
+    } else {
+        state.simulate_coalesced++;
+        if (!reset_pending) {
+            reset_pending = true;
+            set_timeout(conf.simulate_window - elapsed, 0, simulate_fd, 0);
+        }
+    }
+}
+
+/*
+ * A single client reset for all thresholds.
+ * Do not rely on clightd emitting Idle(false) on Stop:
+ * simulated activity resets every threshold, disarming idler_fd too.
+ */
+static void reset_client(void) {
+    clock_gettime(CLOCK_BOOTTIME, &last_reset);
+    client_stop();
+    if (client_idle) {
+        clock_gettime(CLOCK_MONOTONIC, &state.idle_ts);
+    }
+    set_active();
+    client_start();
+}
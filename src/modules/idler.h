@@ -0,0 +1,10 @@
+#pragma once
+
+#include "bus.h"
+
+typedef void (*idler_cb)(bool idle);
+
+bool idler_started(void);
+int idler_register(int timeout, idler_cb cb);
+void idler_set_timeout(int id, int timeout);
+void idler_deregister(int id);
@@ -1,6 +1,11 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <module/map.h>
 #include "bus.h"
 #include "config.h"
+#include "loader.h"
+#include "series.h"
 
 #define VALIDATE_PARAMS(m, signature, ...) \
     int r = sd_bus_message_read(m, signature, __VA_ARGS__); \
@@ -11,18 +16,58 @@
 
 #define CLIGHT_COOKIE -1
 #define CLIGHT_INH_KEY "LockClight"
+#define BUS_NAME_MAX 255                        // dbus names max length
+#define COOKIE_KEY_MAX 16
+#define MAX_PENDING_INHIBITS 16                 // Inhibit calls waiting for their reply, when monitoring ScreenSaver name
+#define NUM_EMITTED_PROPS (SUSPEND_UPD + 1)     // RESUME_UPD maps to SUSPEND_UPD "Suspended" property; _REQ slots stay empty
+#define EMITTED_PROP(field) { offsetof(state_t, field), sizeof(((state_t *)0)->field) }
+#define MAX_PENDING_STORES 8                    // Store calls waiting for a config write
+#define MAX_BATCH_REQS 32                       // more than distinct requests Conf setters can publish
 
 typedef struct {
     int cookie;
     int refs;
+    char owner[BUS_NAME_MAX + 1];               // lock_map key of this lock
+    sd_bus_slot *slot;                          // NameOwnerChanged match for owner
 } lock_t;
 
+typedef struct {
+    uint64_t serial;                            // Inhibit method call serial; 0 if unused
+    uint64_t seq;                               // insertion order, to evict oldest call when full
+    char sender[BUS_NAME_MAX + 1];
+    char app_name[NAME_MAX + 1];
+    char reason[NAME_MAX + 1];
+} pending_inhibit_t;
+
+typedef struct {
+    size_t offset;
+    size_t size;
+} emitted_prop_t;
+
+typedef struct {
+    double tokens[SIZE_RATE];                   // token bucket for each method class
+    struct timespec last[SIZE_RATE];            // last refill of each bucket; 0 if never used
+    uint64_t calls;                             // accepted rate-limited calls
+    uint64_t rejected;                          // refused calls
+    sd_bus_slot *slot;                          // NameOwnerChanged match for this sender
+} sender_t;
+
+static void mark_dirty(enum mod_msg_types type);
+static void emit_dirty(void);
+
 /** org.freedesktop.ScreenSaver spec implementation **/
 static int start_inhibit_monitor(void);
+static int become_monitor(void);
+static void stop_monitor(void);
+static int on_sc_owner_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error);
 static void inhibit_parse_msg(sd_bus_message *m);
+static void inhibit_parse_call(sd_bus_message *m, const char *member);
+static void inhibit_parse_reply(sd_bus_message *m);
 static int on_bus_name_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error);
 static int create_inhibit(int *cookie, const char *key, const char *app_name, const char *reason);
 static int drop_inhibit(int *cookie, const char *key, bool force);
+static int new_cookie(void);
+static void cookie_key(int cookie, char key[COOKIE_KEY_MAX]);
 static int method_clight_inhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int method_inhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int method_uninhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
@@ -30,13 +75,24 @@ static int method_simulate_activity(sd_bus_message *m, void *userdata, sd_bus_er
 static int method_get_inhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 
 /** Clight bus api **/
+static int rate_filter(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int rate_class(sd_bus_message *m);
+static int on_sender_changed(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static void free_sender(void *data);
+static int method_get_rate_stats(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static map_ret_code append_rate_stats(void *userdata, const char *key, void *value);
 static int get_version(sd_bus *b, const char *path, const char *interface, const char *property,
                        sd_bus_message *reply, void *userdata, sd_bus_error *error);
 static int method_calibrate(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int method_load(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int method_unload(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static void on_module_loaded(const char *path, int r, void *userdata);
+static int method_get_history(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int append_history(uint64_t time, double value, void *userdata);
 static int get_curve(sd_bus *bus, const char *path, const char *interface, const char *property,
                      sd_bus_message *reply, void *userdata, sd_bus_error *error);
+static int get_latency(sd_bus *bus, const char *path, const char *interface, const char *property,
+                       sd_bus_message *reply, void *userdata, sd_bus_error *error);
 static int set_curve(sd_bus *bus, const char *path, const char *interface, const char *property,
                     sd_bus_message *value, void *userdata, sd_bus_error *error);
 static int get_location(sd_bus *bus, const char *path, const char *interface, const char *property,
@@ -45,6 +101,7 @@ static int set_location(sd_bus *bus, const char *path, const char *interface, co
                         sd_bus_message *value, void *userdata, sd_bus_error *error);
 static int set_timeouts(sd_bus *bus, const char *path, const char *interface, const char *property,
                      sd_bus_message *value, void *userdata, sd_bus_error *error);
+static message_t *timeout_req(const void *userdata);
 static int set_gamma(sd_bus *bus, const char *path, const char *interface, const char *property,
                      sd_bus_message *value, void *userdata, sd_bus_error *error);
 static int set_auto_calib(sd_bus *bus, const char *path, const char *interface, const char *property,
@@ -53,7 +110,28 @@ static int set_event(sd_bus *bus, const char *path, const char *interface, const
                         sd_bus_message *value, void *userdata, sd_bus_error *error);
 static int set_screen_contrib(sd_bus *bus, const char *path, const char *interface, const char *property,
                               sd_bus_message *value, void *userdata, sd_bus_error *error);
+static int set_gamma_curve(sd_bus *bus, const char *path, const char *interface, const char *property,
+                           sd_bus_message *value, void *userdata, sd_bus_error *error);
 static int method_store_conf(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int add_store_call(sd_bus_message *calls[MAX_PENDING_STORES], int *num, sd_bus_message *m);
+static void start_store(void);
+static void *store_thread(void *arg);
+static void store_completed(void);
+static void reply_store_calls(int r);
+static int method_set_many(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int set_many(sd_bus_message *m, sd_bus_error *ret_error);
+static int method_get_many(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static const sd_bus_vtable *find_conf_property(const char *name);
+static size_t conf_str_size(size_t offset);
+static int validate_conf_value(sd_bus_message *m, const sd_bus_vtable *vt, sd_bus_error *ret_error);
+static int apply_conf_value(sd_bus_message *m, const sd_bus_vtable *vt, sd_bus_error *ret_error);
+static void publish_req(const message_t *msg);
+static bool batch_req(const message_t *msg);
+static void flush_batch(bool apply);
+static bool batch_publishes(int idx, int n);
+static int req_key(const message_t *msg);
+static bool req_is_current(const message_t *msg);
+static void store_req(message_t *msg);
 
 static const char object_path[] = "/org/clight/clight";
 static const char bus_interface[] = "org.clight.clight";
@@ -76,10 +154,21 @@ static const sd_bus_vtable clight_vtable[] = {
     SD_BUS_PROPERTY("Temp", "i", NULL, offsetof(state_t, current_temp), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("Location", "(dd)", get_location, offsetof(state_t, current_loc), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("ScreenComp", "d", NULL, offsetof(state_t, screen_comp), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("GammaSkippedSets", "t", NULL, offsetof(state_t, gamma_skipped_sets), 0),
+    SD_BUS_PROPERTY("Suspended", "b", NULL, offsetof(state_t, suspended), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("ResumeLatency", "t", NULL, offsetof(state_t, resume_latency), 0),
+    SD_BUS_PROPERTY("SimulateCoalesced", "t", NULL, offsetof(state_t, simulate_coalesced), 0),
+    SD_BUS_PROPERTY("InhibitMonitored", "t", NULL, offsetof(state_t, inhibit_monitored), 0),
+    SD_BUS_PROPERTY("InhibitMonitorHandled", "t", NULL, offsetof(state_t, inhibit_monitor_handled), 0),
+    SD_BUS_PROPERTY("DimLatency", "at", get_latency, offsetof(state_t, display_latency[ENTER]), 0),
+    SD_BUS_PROPERTY("UndimLatency", "at", get_latency, offsetof(state_t, display_latency[EXIT]), 0),
+    SD_BUS_PROPERTY("RateLimited", "t", NULL, offsetof(state_t, rate_limited), 0),
     SD_BUS_METHOD("Calibrate", NULL, NULL, method_calibrate, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Inhibit", "b", NULL, method_clight_inhibit, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Load", "s", NULL, method_load, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Unload", "s", NULL, method_unload, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("GetHistory", "stt", "a(td)", method_get_history, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("GetRateStats", NULL, "a(stt)", method_get_rate_stats, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_VTABLE_END
 };
 
@@ -91,6 +180,8 @@ static const sd_bus_vtable conf_vtable[] = {
     SD_BUS_PROPERTY("NoDpms", "b", NULL, offsetof(conf_t, no_dpms), SD_BUS_VTABLE_PROPERTY_CONST),
     SD_BUS_PROPERTY("NoScreen", "b", NULL, offsetof(conf_t, no_screen), SD_BUS_VTABLE_PROPERTY_CONST),
     SD_BUS_PROPERTY("ScreenSamples", "i", NULL, offsetof(conf_t, screen_samples), SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("HistorySize", "i", NULL, offsetof(conf_t, history_size), SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("ControlSocket", "b", NULL, offsetof(conf_t, control_socket), SD_BUS_VTABLE_PROPERTY_CONST),
     SD_BUS_WRITABLE_PROPERTY("ScreenContrib", "d", NULL, set_screen_contrib, offsetof(conf_t, screen_contrib), 0),
     SD_BUS_WRITABLE_PROPERTY("Sunrise", "s", NULL, set_event, offsetof(conf_t, day_events[SUNRISE]), 0),
     SD_BUS_WRITABLE_PROPERTY("Sunset", "s", NULL, set_event, offsetof(conf_t, day_events[SUNSET]), 0),
@@ -106,6 +197,7 @@ static const sd_bus_vtable conf_vtable[] = {
     SD_BUS_WRITABLE_PROPERTY("NumCaptures", "i", NULL, NULL, offsetof(conf_t, num_captures), 0),
     SD_BUS_WRITABLE_PROPERTY("SensorName", "s", NULL, NULL, offsetof(conf_t, dev_name), 0),
     SD_BUS_WRITABLE_PROPERTY("SensorSettings", "s", NULL, NULL, offsetof(conf_t, dev_opts), 0),
+    SD_BUS_WRITABLE_PROPERTY("NativeCapture", "b", NULL, NULL, offsetof(conf_t, native_capture), 0),
     SD_BUS_WRITABLE_PROPERTY("BacklightSyspath", "s", NULL, NULL, offsetof(conf_t, screen_path), 0),
     SD_BUS_WRITABLE_PROPERTY("EventDuration", "i", NULL, NULL, offsetof(conf_t, event_duration), 0),
     SD_BUS_WRITABLE_PROPERTY("DimmerPct", "d", NULL, NULL, offsetof(conf_t, dimmer_pct), 0),
@@ -124,7 +216,11 @@ static const sd_bus_vtable conf_vtable[] = {
     SD_BUS_WRITABLE_PROPERTY("BattCurvePoints", "ad", get_curve, set_curve, offsetof(conf_t, regression_points[ON_BATTERY]), 0),
     SD_BUS_WRITABLE_PROPERTY("ShutterThreshold", "d", NULL, NULL, offsetof(conf_t, shutter_threshold), 0),
     SD_BUS_WRITABLE_PROPERTY("GammaLongTransition", "b", NULL, NULL, offsetof(conf_t, gamma_long_transition), 0),
+    SD_BUS_WRITABLE_PROPERTY("GammaTransCurve", "i", NULL, set_gamma_curve, offsetof(conf_t, gamma_trans_curve), 0),
+    SD_BUS_WRITABLE_PROPERTY("SimulateWindow", "i", NULL, NULL, offsetof(conf_t, simulate_window), 0),
     SD_BUS_METHOD("Store", NULL, NULL, method_store_conf, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("SetMany", "a{sv}", NULL, method_set_many, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("GetMany", "as", "a{sv}", method_get_many, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_VTABLE_END
 };
 
@@ -169,10 +265,52 @@ DECLARE_MSG(sunrise_req, SUNRISE_REQ);
 DECLARE_MSG(sunset_req, SUNSET_REQ);
 DECLARE_MSG(simulate_req, SIMULATE_REQ);
 
-static map_t *lock_map;
+static map_t *lock_map;                     // owner -> lock
+static map_t *cookie_map;                   // cookie -> lock (owned by lock_map)
+static map_t *sender_map;                   // sender -> rate limiting buckets
+static char sc_owner[PATH_MAX + 1];         // unique name of org.freedesktop.ScreenSaver owner, when monitoring it
+static pending_inhibit_t pending_inhibits[MAX_PENDING_INHIBITS];
+static uint64_t pending_seq;                // last pending_inhibit_t seq
+static sd_bus_slot *sc_owner_slot;          // NameOwnerChanged match for org.freedesktop.ScreenSaver, when monitoring it
+static int monbus_fd = -1;
 static sd_bus *userbus, *monbus;
 static sd_bus_message *curve_message; // this is used to keep curve points data lingering around in set_curve
-static sd_bus_slot *lock_slot;
+
+/* State fields exposed by each _UPD topic property */
+static const emitted_prop_t emitted_props[NUM_EMITTED_PROPS] = {
+    [LOC_UPD] = EMITTED_PROP(current_loc),
+    [UPOWER_UPD] = EMITTED_PROP(ac_state),
+    [INHIBIT_UPD] = EMITTED_PROP(inhibited),
+    [DISPLAY_UPD] = EMITTED_PROP(display_state),
+    [DAYTIME_UPD] = EMITTED_PROP(day_time),
+    [IN_EVENT_UPD] = EMITTED_PROP(in_event),
+    [SUNRISE_UPD] = EMITTED_PROP(day_events[SUNRISE]),
+    [SUNSET_UPD] = EMITTED_PROP(day_events[SUNSET]),
+    [TEMP_UPD] = EMITTED_PROP(current_temp),
+    [AMBIENT_BR_UPD] = EMITTED_PROP(ambient_br),
+    [BL_UPD] = EMITTED_PROP(current_bl_pct),
+    [KBD_BL_UPD] = EMITTED_PROP(current_kbd_pct),
+    [SCR_BL_UPD] = EMITTED_PROP(screen_comp),
+    [SUSPEND_UPD] = EMITTED_PROP(suspended),
+};
+static uint8_t last_emitted[NUM_EMITTED_PROPS][sizeof(loc_t)];  // loc_t is the biggest emitted property
+static bool dirty[NUM_EMITTED_PROPS];
+static int emit_fd = -1;
+
+/* Store is written by store_thread, then its result is sent back to main loop through store_fds */
+static int store_fds[2] = { -1, -1 };
+static pthread_t store_tid;
+static bool store_running;
+static int store_result;                    // result of last store_thread run, read by destroy() after joining it
+static conf_t storing;                      // snapshot being written by store_thread
+static conf_t last_stored;                  // snapshot successfully written by last store
+static bool has_stored;
+static sd_bus_message *store_calls[MAX_PENDING_STORES];     // waiting for running store
+static int num_store_calls;
+static sd_bus_message *queued_calls[MAX_PENDING_STORES];    // arrived after running store snapshot was taken, with a different conf
+static int num_queued_calls;
+static message_t batch_reqs[MAX_BATCH_REQS];  // requests published by Conf setters during SetMany
+static int num_batch_reqs = -1;             // -1 when not batching
 
 MODULE("INTERFACE");
 
@@ -238,8 +376,22 @@ static void init(void) {
         if (r < 0) {
             WARN("Failed to create %s dbus interface: %s\n", bus_interface, strerror(-r));
         } else {
-            /* Subscribe to any topic expept REQUESTS */
-            m_subscribe("^[^Req].*");
+            /* 
+             * Subscribe to every update topic; topics are matched as regexes,
+             * thus eg: "Location" matches "ReqLocation" too: requests are filtered out in receive().
+             */
+            for (enum mod_msg_types t = LOC_UPD; t < MSGS_SIZE; t++) {
+                if (IS_UPD(t)) {
+                    m_subscribe(topics[t]);
+                }
+            }
+            
+            /* Properties values as seen by clients until first PropertiesChanged */
+            for (int i = 0; i < NUM_EMITTED_PROPS; i++) {
+                memcpy(last_emitted[i], (uint8_t *)&state + emitted_props[i].offset, emitted_props[i].size);
+            }
+            emit_fd = start_timer(CLOCK_MONOTONIC, 0, 0);
+            m_register_fd(emit_fd, true, NULL);
             
             /** org.freedesktop.ScreenSaver API **/
             if (sd_bus_request_name(userbus, sc_interface, SD_BUS_NAME_REPLACE_EXISTING) < 0) {
@@ -250,7 +402,15 @@ static void init(void) {
                 }
             }
             lock_map = map_new(true, free);
+            cookie_map = map_new(true, NULL);
             /**                                 **/
+            
+            sender_map = map_new(true, free_sender);
+            sd_bus_add_filter(userbus, NULL, rate_filter, NULL);
+            
+            if (pipe2(store_fds, O_CLOEXEC) == 0) {
+                m_register_fd(store_fds[0], true, NULL);
+            }
         }
     }
     
@@ -271,6 +431,15 @@ static bool evaluate() {
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
     case FD_UPD: {
+        if (msg->fd_msg->fd == emit_fd) {
+            read_timer(emit_fd);
+            emit_dirty();
+            break;
+        }
+        if (msg->fd_msg->fd == store_fds[0]) {
+            store_completed();
+            break;
+        }
         sd_bus *b = (sd_bus *)msg->fd_msg->userptr;
         int r;
         do {
@@ -285,28 +454,97 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     }
     case SYSTEM_UPD:
         break;
-    default:
-        if (userbus) {
-            DEBUG("Emitting %s property\n", msg->ps_msg->topic);
-            sd_bus_emit_properties_changed(userbus, object_path, bus_interface, msg->ps_msg->topic, NULL);
+    case RESUME_UPD:
+        /* Both SUSPEND_UPD and RESUME_UPD map to "Suspended" property */
+        mark_dirty(SUSPEND_UPD);
+        break;
+    default: {
+        /* Every other update maps to its own property */
+        const enum mod_msg_types type = MSG_TYPE();
+        if (IS_UPD(type) && type < NUM_EMITTED_PROPS) {
+            mark_dirty(type);
         }
         break;
     }
+    }
 }
 
 static void destroy(void) {
+    if (emit_fd >= 0) {
+        close(emit_fd);
+    }
+    map_free(sender_map);
+    if (store_running) {
+        /* Let config write complete, then answer its callers */
+        if (!pthread_equal(store_tid, pthread_self())) {
+            pthread_join(store_tid, NULL);
+        }
+        store_running = false;
+        reply_store_calls(store_result);
+    }
+    /* Calls queued for a further store won't be served */
+    memcpy(store_calls, queued_calls, num_queued_calls * sizeof(sd_bus_message *));
+    num_store_calls = num_queued_calls;
+    num_queued_calls = 0;
+    reply_store_calls(-1);
+    if (store_fds[1] >= 0) {
+        close(store_fds[1]);
+    }
+    if (sc_owner_slot) {
+        sc_owner_slot = sd_bus_slot_unref(sc_owner_slot);
+    }
     if (userbus) {
         sd_bus_release_name(userbus, bus_interface);
         sd_bus_release_name(userbus, sc_interface);
         userbus = sd_bus_flush_close_unref(userbus);
     }
-    if (monbus) {
-        monbus = sd_bus_flush_close_unref(monbus);
-    }
+    stop_monitor();
+    map_free(cookie_map);
     map_free(lock_map);
     curve_message = sd_bus_message_unref(curve_message);
 }
 
+/*
+ * Properties are not emitted right away: updates received
+ * during this loop iteration are collected and emitted together
+ * by emit_dirty(), as soon as emit_fd fires.
+ */
+static void mark_dirty(enum mod_msg_types type) {
+    if (!userbus) {
+        return;
+    }
+    
+    bool armed = false;
+    for (int i = 0; i < NUM_EMITTED_PROPS && !armed; i++) {
+        armed = dirty[i];
+    }
+    dirty[type] = true;
+    if (!armed) {
+        set_timeout(0, 1, emit_fd, 0);
+    }
+}
+
+/* Emit a single PropertiesChanged with every dirty property whose value actually changed */
+static void emit_dirty(void) {
+    const char *names[NUM_EMITTED_PROPS + 1] = {0};
+    int num_names = 0;
+    
+    for (int i = 0; i < NUM_EMITTED_PROPS; i++) {
+        if (dirty[i]) {
+            dirty[i] = false;
+            const uint8_t *val = (uint8_t *)&state + emitted_props[i].offset;
+            if (memcmp(last_emitted[i], val, emitted_props[i].size)) {
+                memcpy(last_emitted[i], val, emitted_props[i].size);
+                names[num_names++] = topics[i];
+            }
+        }
+    }
+    if (num_names > 0) {
+        DEBUG("Emitting %d properties\n", num_names);
+        sd_bus_emit_properties_changed_strv(userbus, object_path, bus_interface, (char **)names);
+    }
+}
+
 /** org.freedesktop.ScreenSaver spec implementation: https://people.freedesktop.org/~hadess/idle-inhibition-spec/re01.html **/
 
 /* 
@@ -316,6 +554,25 @@ static void destroy(void) {
  * Stolen from: https://github.com/systemd/systemd/blob/master/src/busctl/busctl.c#L1203 (busctl monitor)
  */
 static int start_inhibit_monitor(void) {
+    /*
+     * Replies are monitored by ScreenSaver owner unique name:
+     * follow owner changes (eg: its restarts) to monitor the new one.
+     */
+    USERBUS_ARG(args, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameOwnerChanged");
+    if (add_match_arg0(&args, sc_interface, &sc_owner_slot, on_sc_owner_changed) != 0) {
+        INFO("Failed to follow %s owner changes.\n", sc_interface);
+    }
+    
+    USERBUS_ARG(owner_args, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "GetNameOwner");
+    if (call(sc_owner, "s", &owner_args, "s", sc_interface) != 0) {
+        *sc_owner = '\0';
+        INFO("Failed to get %s owner; inhibition cookies won't be tracked.\n", sc_interface);
+    }
+    return become_monitor();
+}
+
+/* Monitor connection can't change its rules: a new one is needed for each ScreenSaver owner */
+static int become_monitor(void) {
     int r = sd_bus_new(&monbus);
     if (r < 0) {
         WARN("Failed to create monitor: %m\n");
@@ -359,33 +616,137 @@ static int start_inhibit_monitor(void) {
     
     sd_bus_start(monbus);
     
+    /* 
+     * Only monitor Inhibit/UnInhibit calls; 
+     * to track real cookies, monitor replies sent by ScreenSaver owner too.
+     */
+    char reply_rule[PATH_MAX + 64] = {0};
+    if (strlen(sc_owner)) {
+        snprintf(reply_rule, sizeof(reply_rule), "type='method_return',sender='%s'", sc_owner);
+    }
+    
     USERBUS_ARG(args, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus.Monitoring", "BecomeMonitor");
     args.bus = monbus;
     
-    r = call(NULL, "", &args, "asu", 1, "destination='org.freedesktop.ScreenSaver'", 0);
+    const char inhibit_rule[] = "type='method_call',destination='org.freedesktop.ScreenSaver',member='Inhibit'";
+    const char uninhibit_rule[] = "type='method_call',destination='org.freedesktop.ScreenSaver',member='UnInhibit'";
+    if (strlen(sc_owner)) {
+        r = call(NULL, "", &args, "asu", 3, inhibit_rule, uninhibit_rule, reply_rule, 0);
+    } else {
+        r = call(NULL, "", &args, "asu", 2, inhibit_rule, uninhibit_rule, 0);
+    }
     if (r == 0) {
         sd_bus_process(monbus, NULL);
-        int fd = sd_bus_get_fd(monbus);
-        m_register_fd(dup(fd), true, monbus);
+        monbus_fd = dup(sd_bus_get_fd(monbus));
+        m_register_fd(monbus_fd, true, monbus);
     }
     return r;
 }
 
+static void stop_monitor(void) {
+    if (monbus_fd >= 0) {
+        /* Registered with autoclose */
+        m_deregister_fd(monbus_fd);
+        monbus_fd = -1;
+    }
+    if (monbus) {
+        monbus = sd_bus_flush_close_unref(monbus);
+    }
+    /* Their replies, if any, will come from the old owner */
+    memset(pending_inhibits, 0, sizeof(pending_inhibits));
+}
+
+/* ScreenSaver owner changed: monitor replies from the new one (if any; otherwise use our own cookies) */
+static int on_sc_owner_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    const char *name = NULL, *old_owner = NULL, *new_owner = NULL;
+    if (sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner) >= 0 && new_owner && strcmp(new_owner, sc_owner)) {
+        DEBUG("%s owner changed: '%s' -> '%s'.\n", sc_interface, old_owner, new_owner);
+        stop_monitor();
+        snprintf(sc_owner, sizeof(sc_owner), "%s", new_owner);
+        if (become_monitor() != 0) {
+            WARN("Failed to register %s inhibition monitor.\n", sc_interface);
+            stop_monitor();
+        }
+    }
+    return 0;
+}
+
 static void inhibit_parse_msg(sd_bus_message *m) {
-    if (sd_bus_message_get_member(m)) {
-        const char *member = sd_bus_message_get_member(m);
-        if (!strcmp(member, sc_vtable[1].x.method.member)) {
+    uint8_t type;
+    if (sd_bus_message_get_type(m, &type) < 0) {
+        return;
+    }
+    
+    state.inhibit_monitored++;
+    if (type == SD_BUS_MESSAGE_METHOD_RETURN) {
+        inhibit_parse_reply(m);
+    } else if (type == SD_BUS_MESSAGE_METHOD_CALL && sd_bus_message_get_member(m)) {
+        inhibit_parse_call(m, sd_bus_message_get_member(m));
+    }
+}
+
+static void inhibit_parse_call(sd_bus_message *m, const char *member) {
+    if (!strcmp(member, sc_vtable[1].x.method.member)) {
+        char *app_name = NULL, *reason = NULL;
+        int r = sd_bus_message_read(m, "ss", &app_name, &reason); 
+        if (r < 0) { 
+            WARN("Failed to parse parameters: %s\n", strerror(-r));
+        } else if (!strlen(sc_owner)) {
+            /* Replies are not monitored: use our own cookie */
             int cookie = 0;
-            char *app_name = NULL, *reason = NULL;
-            int r = sd_bus_message_read(m, "ss", &app_name, &reason); 
-            if (r < 0) { 
-                WARN("Failed to parse parameters: %s\n", strerror(-r));
-            } else {
-                create_inhibit(&cookie, sd_bus_message_get_sender(m), app_name, reason);
+            create_inhibit(&cookie, sd_bus_message_get_sender(m), app_name, reason);
+            state.inhibit_monitor_handled++;
+        } else {
+            /* 
+             * Wait for the reply to know real cookie.
+             * Free slots have serial 0: store call in the first free one, otherwise evict the oldest stored one
+             * (serials are per sender, thus they can't tell which call is older).
+             */
+            uint64_t serial = 0;
+            sd_bus_message_get_cookie(m, &serial);
+            
+            pending_inhibit_t *p = &pending_inhibits[0];
+            for (int i = 1; i < MAX_PENDING_INHIBITS && p->serial != 0; i++) {
+                if (pending_inhibits[i].serial == 0 || pending_inhibits[i].seq < p->seq) {
+                    p = &pending_inhibits[i];
+                }
             }
-        } else if (!strcmp(member, sc_vtable[2].x.method.member)) {
+            p->serial = serial;
+            p->seq = ++pending_seq;
+            strncpy(p->sender, sd_bus_message_get_sender(m), BUS_NAME_MAX);
+            strncpy(p->app_name, app_name, NAME_MAX);
+            strncpy(p->reason, reason, NAME_MAX);
+        }
+    } else if (!strcmp(member, sc_vtable[2].x.method.member)) {
+        int cookie;
+        if (sd_bus_message_read(m, "u", &cookie) >= 0) {
+            drop_inhibit(&cookie, sd_bus_message_get_sender(m), false);
+        } else {
             drop_inhibit(NULL, sd_bus_message_get_sender(m), false);
         }
+        state.inhibit_monitor_handled++;
+    }
+}
+
+/* Only replies to tracked Inhibit calls are handled: they hold the real inhibition cookie */
+static void inhibit_parse_reply(sd_bus_message *m) {
+    uint64_t serial = 0;
+    const char *dest = sd_bus_message_get_destination(m);
+    if (sd_bus_message_get_reply_cookie(m, &serial) < 0 || serial == 0 || !dest) {
+        return;
+    }
+    
+    for (int i = 0; i < MAX_PENDING_INHIBITS; i++) {
+        pending_inhibit_t *p = &pending_inhibits[i];
+        if (p->serial == serial && !strcmp(p->sender, dest)) {
+            int cookie;
+            if (sd_bus_message_read(m, "u", &cookie) >= 0) {
+                create_inhibit(&cookie, p->sender, p->app_name, p->reason);
+                state.inhibit_monitor_handled++;
+            }
+            p->serial = 0;
+            break;
+        }
     }
 }
 
@@ -414,12 +775,29 @@ static int create_inhibit(int *cookie, const char *key, const char *app_name, co
     } else {
         lock_t *l = malloc(sizeof(lock_t));
         if (l) {
-            if (*cookie != CLIGHT_COOKIE) {
-                *cookie = random();
+            /* Cookie may be CLIGHT_COOKIE, or a real cookie tracked while monitoring */
+            if (*cookie == 0) {
+                *cookie = new_cookie();
             }
             l->cookie = *cookie;
             l->refs = 1;
+            strncpy(l->owner, key, BUS_NAME_MAX);
+            l->owner[BUS_NAME_MAX] = '\0';
+            l->slot = NULL;
             map_put(lock_map, key, l);
+            
+            /* 
+             * Only listen on NameOwnerChanged signals for this owner,
+             * to be woken up only when it disappears (unique names start with ':').
+             */
+            if (key[0] == ':') {
+                USERBUS_ARG(args, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameOwnerChanged");
+                add_match_arg0(&args, key, &l->slot, on_bus_name_changed);
+            }
+            
+            char ck[COOKIE_KEY_MAX];
+            cookie_key(l->cookie, ck);
+            map_put(cookie_map, ck, l);
 
             DEBUG("New ScreenSaver inhibition held by %s: %s. Cookie: %d\n", app_name, reason, l->cookie);
 
@@ -427,10 +805,6 @@ static int create_inhibit(int *cookie, const char *key, const char *app_name, co
                 inhibit_req.inhibit.old = false;
                 inhibit_req.inhibit.new = true;
                 M_PUB(&inhibit_req);
-
-                /* Start listening on NameOwnerChanged signals */                
-                USERBUS_ARG(args, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameOwnerChanged");
-                add_match(&args, &lock_slot, on_bus_name_changed);
             }
         } else {
             return -1;
@@ -440,17 +814,15 @@ static int create_inhibit(int *cookie, const char *key, const char *app_name, co
 }
 
 static int drop_inhibit(int *cookie, const char *key, bool force) {
-    lock_t *l = map_get(lock_map, key);
-    if (!l && cookie) {
-        /* May be another sender is asking to drop a cookie? Linear search */
-        for (map_itr_t *itr = map_itr_new(lock_map); itr; itr = map_itr_next(itr)) {
-            lock_t *tmp = (lock_t *)map_itr_get_data(itr);
-            if (tmp->cookie == *cookie) {
-                l = tmp;
-                free(itr);
-                itr = NULL;
-            }
-        }
+    lock_t *l = NULL;
+    char ck[COOKIE_KEY_MAX];
+    if (cookie) {
+        /* Cookie index: another sender may be asking to drop a cookie */
+        cookie_key(*cookie, ck);
+        l = map_get(cookie_map, ck);
+    }
+    if (!l) {
+        l = map_get(lock_map, key);
     }
 
     if (l) {
@@ -460,16 +832,22 @@ static int drop_inhibit(int *cookie, const char *key, bool force) {
         } else {
             l->refs = 0;
         }
-        if (l->refs == 0 && map_remove(lock_map, key) == MAP_OK) {
-            DEBUG("Dropped ScreenSaver inhibition held by cookie: %d.\n", c);
-
-            if (map_length(lock_map) == 0) {
-                inhibit_req.inhibit.old = true;
-                inhibit_req.inhibit.new = false;
-                M_PUB(&inhibit_req);
+        if (l->refs <= 0) {
+            /* Stop listening on NameOwnerChanged signals for this owner */
+            l->slot = sd_bus_slot_unref(l->slot);
+            
+            /* Lock must be removed by its owner key, that may differ from sender one */
+            char owner[BUS_NAME_MAX + 1];
+            strcpy(owner, l->owner);
+            cookie_key(c, ck);
+            if (map_remove(cookie_map, ck) == MAP_OK && map_remove(lock_map, owner) == MAP_OK) {
+                DEBUG("Dropped ScreenSaver inhibition held by cookie: %d.\n", c);
                 
-                /* Stop listening on NameOwnerChanged signals */
-                lock_slot = sd_bus_slot_unref(lock_slot);
+                if (map_length(lock_map) == 0) {
+                    inhibit_req.inhibit.old = true;
+                    inhibit_req.inhibit.new = false;
+                    M_PUB(&inhibit_req);
+                }
             }
         }
         return 0;
@@ -477,6 +855,25 @@ static int drop_inhibit(int *cookie, const char *key, bool force) {
     return -1;
 }
 
+/*
+ * Cookies are allocated sequentially, skipping 0, CLIGHT_COOKIE
+ * and any cookie still in use after wrapping around.
+ */
+static int new_cookie(void) {
+    static int last_cookie;
+    
+    char ck[COOKIE_KEY_MAX];
+    do {
+        last_cookie = last_cookie == INT_MAX ? 1 : last_cookie + 1;
+        cookie_key(last_cookie, ck);
+    } while (map_has_key(cookie_map, ck));
+    return last_cookie;
+}
+
+static void cookie_key(int cookie, char key[COOKIE_KEY_MAX]) {
+    snprintf(key, COOKIE_KEY_MAX, "%d", cookie);
+}
+
 static int method_clight_inhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
     int inhibit;
     VALIDATE_PARAMS(m, "b", &inhibit);
@@ -547,16 +944,28 @@ static int method_load(sd_bus_message *m, void *userdata, sd_bus_error *ret_erro
     const char *module_path;
 
     VALIDATE_PARAMS(m, "s", &module_path);
-    if (m_load(module_path) == MOD_OK) {
-        INFO("'%s' loaded.\n", module_path);
-        return sd_bus_reply_method_return(m, NULL);
+    /* Reply once LOADER actually loaded the module */
+    sd_bus_message_ref(m);
+    if (loader_load(module_path, on_module_loaded, m) == 0) {
+        return 1;
     }
+    sd_bus_message_unref(m);
 
     WARN("'%s' failed to load.\n", module_path);
     sd_bus_error_set_errno(ret_error, EINVAL);
     return -EINVAL;
 }
 
+static void on_module_loaded(const char *path, int r, void *userdata) {
+    sd_bus_message *m = (sd_bus_message *)userdata;
+    if (r == 0) {
+        sd_bus_reply_method_return(m, NULL);
+    } else {
+        sd_bus_reply_method_errno(m, EINVAL, NULL);
+    }
+    sd_bus_message_unref(m);
+}
+
 static int method_unload(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
     const char *module_path;
 
@@ -571,6 +980,183 @@ static int method_unload(sd_bus_message *m, void *userdata, sd_bus_error *ret_er
     return -EINVAL;
 }
 
+/*
+ * Return all records for a given topic (one of AmbientBr, BlPct, Temp, ScreenComp)
+ * stored between since and until timestamps (seconds since epoch).
+ */
+static int method_get_history(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    const char *topic;
+    uint64_t since, until;
+    const enum mod_msg_types types[] = { AMBIENT_BR_UPD, BL_UPD, TEMP_UPD, SCR_BL_UPD };
+
+    VALIDATE_PARAMS(m, "stt", &topic, &since, &until);
+    
+    int type = -1;
+    for (int i = 0; i < sizeof(types) / sizeof(*types) && type == -1; i++) {
+        if (!strcmp(topic, topics[types[i]])) {
+            type = types[i];
+        }
+    }
+    if (type == -1) {
+        sd_bus_error_set_const(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Wrong topic.");
+        return -EINVAL;
+    }
+    
+    sd_bus_message *reply = NULL;
+    r = sd_bus_message_new_method_return(m, &reply);
+    if (r >= 0) {
+        r = sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "(td)");
+    }
+    if (r >= 0) {
+        r = series_range(type, since, until, append_history, reply);
+        if (r == -1) {
+            sd_bus_error_set_const(ret_error, SD_BUS_ERROR_FAILED, "History is disabled.");
+            r = -ENOENT;
+        }
+    }
+    if (r >= 0) {
+        r = sd_bus_message_close_container(reply);
+    }
+    if (r >= 0) {
+        r = sd_bus_send(NULL, reply, NULL);
+    }
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+static int append_history(uint64_t time, double value, void *userdata) {
+    return sd_bus_message_append(userdata, "(td)", time, value);
+}
+
+/*
+ * Every message received on user bus goes through this filter,
+ * before being dispatched: calls from a sender that exhausted its token bucket
+ * for called method class are refused right away, without touching any module.
+ * Each bucket holds up to conf.rate_limit tokens and is refilled at conf.rate_limit tokens per minute.
+ */
+static int rate_filter(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    const int c = rate_class(m);
+    const char *sender = sd_bus_message_get_sender(m);
+    if (c == -1 || conf.rate_limit[c] <= 0 || !sender) {
+        return 0;
+    }
+    
+    sender_t *s = map_get(sender_map, sender);
+    if (!s) {
+        s = calloc(1, sizeof(sender_t));
+        if (!s) {
+            return 0;
+        }
+        map_put(sender_map, sender, s);
+        /* Forget sender when it disconnects (unique names start with ':') */
+        if (sender[0] == ':') {
+            USERBUS_ARG(args, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameOwnerChanged");
+            add_match_arg0(&args, sender, &s->slot, on_sender_changed);
+        }
+    }
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const double limit = conf.rate_limit[c];
+    if (s->last[c].tv_sec == 0 && s->last[c].tv_nsec == 0) {
+        s->tokens[c] = limit;
+    } else {
+        const double elapsed = (now.tv_sec - s->last[c].tv_sec) + (now.tv_nsec - s->last[c].tv_nsec) / 1000000000.0;
+        s->tokens[c] = fmin(limit, s->tokens[c] + elapsed * limit / 60);
+    }
+    s->last[c] = now;
+    
+    if (s->tokens[c] >= 1) {
+        s->tokens[c]--;
+        s->calls++;
+        return 0;
+    }
+    
+    const char *member = sd_bus_message_get_member(m);
+    s->rejected++;
+    state.rate_limited++;
+    if (s->rejected == 1) {
+        WARN("%s exceeded its rate limit calling %s.\n", sender, member);
+    } else {
+        DEBUG("Refusing %s call from %s: rate limit exceeded.\n", member, sender);
+    }
+    sd_bus_reply_method_errorf(m, SD_BUS_ERROR_LIMITS_EXCEEDED, "Too many %s calls. Retry later.", member);
+    return 1;
+}
+
+/*
+ * UnInhibit is never limited, not to leak inhibitions;
+ * SimulateUserActivity calls are already coalesced by IDLER.
+ */
+static int rate_class(sd_bus_message *m) {
+    if (sd_bus_message_is_method_call(m, bus_interface, "Calibrate")) {
+        return RATE_CALIBRATE;
+    }
+    if (sd_bus_message_is_method_call(m, bus_interface, "Inhibit") ||
+        sd_bus_message_is_method_call(m, sc_interface, "Inhibit")) {
+        return RATE_INHIBIT;
+    }
+    if (sd_bus_message_is_method_call(m, bus_interface, "Load") ||
+        sd_bus_message_is_method_call(m, bus_interface, "Unload")) {
+        return RATE_LOAD;
+    }
+    if (sd_bus_message_is_method_call(m, "org.clight.clight.Conf", "Store") ||
+        sd_bus_message_is_method_call(m, "org.clight.clight.Conf", "SetMany")) {
+        return RATE_CONF;
+    }
+    /* Conf and Conf/Timeouts property setters */
+    if (sd_bus_message_is_method_call(m, "org.freedesktop.DBus.Properties", "Set")) {
+        const char *path = sd_bus_message_get_path(m);
+        if (path && !strncmp(path, "/org/clight/clight/Conf", strlen("/org/clight/clight/Conf"))) {
+            return RATE_CONF;
+        }
+    }
+    return -1;
+}
+
+static int on_sender_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    const char *name = NULL, *old_owner = NULL, *new_owner = NULL;
+    if (sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner) >= 0) {
+        if (!new_owner || !strlen(new_owner)) {
+            map_remove(sender_map, old_owner);
+        }
+    }
+    return 0;
+}
+
+static void free_sender(void *data) {
+    sender_t *s = (sender_t *)data;
+    sd_bus_slot_unref(s->slot);
+    free(s);
+}
+
+static int method_get_rate_stats(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    sd_bus_message *reply = NULL;
+    int r = sd_bus_message_new_method_return(m, &reply);
+    if (r >= 0) {
+        r = sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "(stt)");
+    }
+    if (r >= 0 && map_length(sender_map) > 0 && map_iterate(sender_map, append_rate_stats, reply) != MAP_OK) {
+        r = -ENOMEM;
+    }
+    if (r >= 0) {
+        r = sd_bus_message_close_container(reply);
+    }
+    if (r >= 0) {
+        r = sd_bus_send(NULL, reply, NULL);
+    }
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+static map_ret_code append_rate_stats(void *userdata, const char *key, void *value) {
+    sender_t *s = (sender_t *)value;
+    if (sd_bus_message_append(userdata, "(stt)", key, s->calls, s->rejected) < 0) {
+        return MAP_ERR;
+    }
+    return MAP_OK;
+}
+
 static int get_curve(sd_bus *bus, const char *path, const char *interface, const char *property,
                      sd_bus_message *reply, void *userdata, sd_bus_error *error) {
     
@@ -581,6 +1167,11 @@ static int get_curve(sd_bus *bus, const char *path, const char *interface, const
     return sd_bus_message_append_array(reply, 'd', userdata, conf.num_points[st] * sizeof(double));
 }
 
+static int get_latency(sd_bus *bus, const char *path, const char *interface, const char *property,
+                       sd_bus_message *reply, void *userdata, sd_bus_error *error) {
+    return sd_bus_message_append_array(reply, 't', userdata, LATENCY_BUCKETS * sizeof(uint64_t));
+}
+
 static int set_curve(sd_bus *bus, const char *path, const char *interface, const char *property,
                      sd_bus_message *value, void *userdata, sd_bus_error *error) {
 
@@ -606,7 +1197,7 @@ static int set_curve(sd_bus *bus, const char *path, const char *interface, const
         }
         curve_req.curve.regression_points = data;
         curve_message = sd_bus_message_ref(value);
-        M_PUB(&curve_req);
+        publish_req(&curve_req);
     }
     return r;
 }
@@ -623,13 +1214,25 @@ static int set_location(sd_bus *bus, const char *path, const char *interface, co
     VALIDATE_PARAMS(value, "(dd)", &loc_req.loc.new.lat, &loc_req.loc.new.lon);
 
     INFO("New location from BUS api: %.2lf %.2lf\n", loc_req.loc.new.lat, loc_req.loc.new.lat);
-    M_PUB(&loc_req);
+    publish_req(&loc_req);
     return r;
 }
 
 static int set_timeouts(sd_bus *bus, const char *path, const char *interface, const char *property,
                             sd_bus_message *value, void *userdata, sd_bus_error *error) {    
     /* Check if we modified currently used timeout! */
+    message_t *msg = timeout_req(userdata);
+    
+    VALIDATE_PARAMS(value, "i", &msg->to.new);
+
+    if (msg) {
+        publish_req(msg);
+    }
+    return r;
+}
+
+/* Request to be published for a timeout property, with its state and daytime */
+static message_t *timeout_req(const void *userdata) {
     message_t *msg = NULL;
     if (userdata == &conf.timeout[ON_AC][DAY]) {
         msg = &bl_to_req;
@@ -666,7 +1269,7 @@ static int set_timeouts(sd_bus *bus, const char *path, const char *interface, co
         dpms_to_req.to.state = ON_AC;
     } else if (userdata == &conf.dpms_timeout[ON_BATTERY]) {
         msg = &dpms_to_req;
-        dimmer_to_req.to.state = ON_BATTERY;
+        dpms_to_req.to.state = ON_BATTERY;
     } else if (userdata == &conf.screen_timeout[ON_AC]) {
         msg = &scr_to_req;
         scr_to_req.to.state = ON_AC;
@@ -674,13 +1277,7 @@ static int set_timeouts(sd_bus *bus, const char *path, const char *interface, co
         msg = &scr_to_req;
         scr_to_req.to.state = ON_BATTERY;
     }
-    
-    VALIDATE_PARAMS(value, "i", &msg->to.new);
-
-    if (msg) {
-        M_PUB(msg);
-    }
-    return r;
+    return msg;
 }
 
 static int set_gamma(sd_bus *bus, const char *path, const char *interface, const char *property,
@@ -689,7 +1286,7 @@ static int set_gamma(sd_bus *bus, const char *path, const char *interface, const
     
     temp_req.temp.daytime = userdata == &conf.temp[DAY] ? DAY : NIGHT;
     temp_req.temp.smooth = -1; // use conf values
-    M_PUB(&temp_req);
+    publish_req(&temp_req);
     return r;
 }
 
@@ -697,7 +1294,7 @@ static int set_auto_calib(sd_bus *bus, const char *path, const char *interface,
                           sd_bus_message *value, void *userdata, sd_bus_error *error) {
     VALIDATE_PARAMS(value, "b", &calib_req.nocalib.new);
     
-    M_PUB(&calib_req);
+    publish_req(&calib_req);
     return r;
 }
 
@@ -711,7 +1308,7 @@ static int set_event(sd_bus *bus, const char *path, const char *interface, const
         msg = &sunset_req;
     }
     strncpy(msg->event.event, event, sizeof(msg->event.event));
-    M_PUB(msg);
+    publish_req(msg);
     return r;
 }
 
@@ -719,16 +1316,498 @@ static int set_screen_contrib(sd_bus *bus, const char *path, const char *interfa
                      sd_bus_message *value, void *userdata, sd_bus_error *error) {
     VALIDATE_PARAMS(value, "d", &contrib_req.contrib.new);
 
-    M_PUB(&contrib_req);
+    publish_req(&contrib_req);
     return r;
 }
 
+static int set_gamma_curve(sd_bus *bus, const char *path, const char *interface, const char *property,
+                           sd_bus_message *value, void *userdata, sd_bus_error *error) {
+    int curve;
+    VALIDATE_PARAMS(value, "i", &curve);
+    
+    if (curve < LINEAR_CURVE || curve >= SIZE_CURVES) {
+        WARN("Wrong parameters.\n");
+        sd_bus_error_set_const(error, SD_BUS_ERROR_INVALID_ARGS, "Wrong gamma transition curve.");
+        return -EINVAL;
+    }
+    conf.gamma_trans_curve = curve;
+    return r;
+}
+
+/*
+ * Config file is written by store_thread, off the main loop,
+ * from a snapshot of conf; Store caller gets its reply when the write completes.
+ * Calls that would write the same snapshot as last store (or running one) are coalesced.
+ */
 static int method_store_conf(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
     int r = -1;
-    if (store_config(LOCAL) == 0) {
+    if (store_fds[0] < 0) {
+        sd_bus_error_set_const(ret_error, SD_BUS_ERROR_FAILED, "Failed to store conf.");
+    } else if (store_running) {
+        if (!memcmp(&conf, &storing, sizeof(conf_t))) {
+            r = add_store_call(store_calls, &num_store_calls, m);
+        } else {
+            r = add_store_call(queued_calls, &num_queued_calls, m);
+        }
+        if (r < 0) {
+            sd_bus_error_set_const(ret_error, SD_BUS_ERROR_LIMITS_EXCEEDED, "Too many pending Store calls.");
+        }
+    } else if (has_stored && !memcmp(&conf, &last_stored, sizeof(conf_t))) {
+        DEBUG("Conf did not change since last store.\n");
         r = sd_bus_reply_method_return(m, NULL);
     } else {
-        sd_bus_error_set_const(ret_error, SD_BUS_ERROR_FAILED, "Failed to store conf.");
+        r = add_store_call(store_calls, &num_store_calls, m);
+        start_store();
+    }
+    return r;
+}
+
+static int add_store_call(sd_bus_message *calls[MAX_PENDING_STORES], int *num, sd_bus_message *m) {
+    if (*num == MAX_PENDING_STORES) {
+        return -EBUSY;
+    }
+    calls[(*num)++] = sd_bus_message_ref(m);
+    return 1;
+}
+
+static void start_store(void) {
+    memcpy(&storing, &conf, sizeof(conf_t));
+    store_running = true;
+    if (pthread_create(&store_tid, NULL, store_thread, NULL) != 0) {
+        WARN("Failed to start store thread; storing conf synchronously.\n");
+        store_thread(NULL);
+        store_tid = pthread_self();
+    }
+}
+
+static void *store_thread(UNUSED void *arg) {
+    const int r = store_config(LOCAL, &storing);
+    store_result = r;
+    if (write(store_fds[1], &r, sizeof(r)) != sizeof(r)) {
+        WARN("Failed to notify store result.\n");
+    }
+    return NULL;
+}
+
+static void store_completed(void) {
+    int r = -1;
+    if (read(store_fds[0], &r, sizeof(r)) != sizeof(r)) {
+        r = -1;
+    }
+    if (!pthread_equal(store_tid, pthread_self())) {
+        pthread_join(store_tid, NULL);
+    }
+    store_running = false;
+    if (r == 0) {
+        memcpy(&last_stored, &storing, sizeof(conf_t));
+        has_stored = true;
+    }
+    reply_store_calls(r);
+    
+    /* Conf changed while storing: store it again for calls that arrived meanwhile */
+    if (num_queued_calls > 0) {
+        memcpy(store_calls, queued_calls, num_queued_calls * sizeof(sd_bus_message *));
+        num_store_calls = num_queued_calls;
+        num_queued_calls = 0;
+        if (has_stored && !memcmp(&conf, &last_stored, sizeof(conf_t))) {
+            reply_store_calls(0);
+        } else {
+            start_store();
+        }
+    }
+}
+
+static void reply_store_calls(int r) {
+    for (int i = 0; i < num_store_calls; i++) {
+        if (r == 0) {
+            sd_bus_reply_method_return(store_calls[i], NULL);
+        } else {
+            sd_bus_reply_method_errorf(store_calls[i], SD_BUS_ERROR_FAILED, "Failed to store conf.");
+        }
+        store_calls[i] = sd_bus_message_unref(store_calls[i]);
+    }
+    num_store_calls = 0;
+}
+
+/*
+ * Set multiple Conf properties at once.
+ * Every value is validated first (see validate_conf_value()):
+ * if any of them is wrong, the call fails and nothing is applied.
+ * Then values are applied in a row, through each property setter;
+ * requests published by setters are batched and coalesced,
+ * to be published only once every value was applied (see flush_batch()).
+ */
+static int method_set_many(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    num_batch_reqs = 0;
+    int r = set_many(m, ret_error);
+    flush_batch(r >= 0);
+    if (r < 0) {
+        return r;
+    }
+    return sd_bus_reply_method_return(m, NULL);
+}
+
+static int set_many(sd_bus_message *m, sd_bus_error *ret_error) {
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            sd_bus_message_rewind(m, true);
+        }
+        
+        int r = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "{sv}");
+        while (r >= 0 && (r = sd_bus_message_enter_container(m, SD_BUS_TYPE_DICT_ENTRY, "sv")) > 0) {
+            const char *name = NULL;
+            r = sd_bus_message_read(m, "s", &name);
+            if (r < 0) {
+                break;
+            }
+            
+            const sd_bus_vtable *vt = find_conf_property(name);
+            if (!vt) {
+                sd_bus_error_setf(ret_error, SD_BUS_ERROR_UNKNOWN_PROPERTY, "Unknown property %s.", name);
+                return -EINVAL;
+            }
+            if (vt->type != _SD_BUS_VTABLE_WRITABLE_PROPERTY) {
+                sd_bus_error_setf(ret_error, SD_BUS_ERROR_PROPERTY_READ_ONLY, "Property %s is read-only.", name);
+                return -EPERM;
+            }
+            
+            r = sd_bus_message_enter_container(m, SD_BUS_TYPE_VARIANT, vt->x.property.signature);
+            if (r < 0) {
+                sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Wrong type for property %s.", name);
+                return r;
+            }
+            if (pass == 0) {
+                r = validate_conf_value(m, vt, ret_error);
+            } else {
+                r = apply_conf_value(m, vt, ret_error);
+            }
+            if (r < 0) {
+                return r;
+            }
+            sd_bus_message_exit_container(m);
+            sd_bus_message_exit_container(m);
+        }
+        if (r < 0) {
+            WARN("Failed to parse parameters: %s\n", strerror(-r));
+            return r;
+        }
+        sd_bus_message_exit_container(m);
+    }
+    return 0;
+}
+
+/* Get a consistent snapshot of multiple Conf properties in a single call */
+static int method_get_many(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    sd_bus_message *reply = NULL;
+    int r = sd_bus_message_new_method_return(m, &reply);
+    if (r >= 0) {
+        r = sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "{sv}");
+    }
+    if (r >= 0) {
+        r = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "s");
+    }
+    
+    const char *name = NULL;
+    while (r >= 0 && (r = sd_bus_message_read(m, "s", &name)) > 0) {
+        const sd_bus_vtable *vt = find_conf_property(name);
+        if (!vt) {
+            sd_bus_error_setf(ret_error, SD_BUS_ERROR_UNKNOWN_PROPERTY, "Unknown property %s.", name);
+            r = -EINVAL;
+            break;
+        }
+        
+        void *value = (uint8_t *)userdata + vt->x.property.offset;
+        r = sd_bus_message_open_container(reply, SD_BUS_TYPE_DICT_ENTRY, "sv");
+        if (r >= 0) {
+            r = sd_bus_message_append(reply, "s", name);
+        }
+        if (r >= 0) {
+            r = sd_bus_message_open_container(reply, SD_BUS_TYPE_VARIANT, vt->x.property.signature);
+        }
+        if (r >= 0) {
+            if (vt->x.property.get) {
+                r = vt->x.property.get(sd_bus_message_get_bus(m), sd_bus_message_get_path(m), 
+                                       sd_bus_message_get_interface(m), name, reply, value, ret_error);
+            } else {
+                r = sd_bus_message_append_basic(reply, vt->x.property.signature[0], value);
+            }
+        }
+        if (r >= 0) {
+            r = sd_bus_message_close_container(reply);
+        }
+        if (r >= 0) {
+            r = sd_bus_message_close_container(reply);
+        }
+    }
+    
+    if (r >= 0) {
+        r = sd_bus_message_exit_container(m);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_close_container(reply);
+    }
+    if (r >= 0) {
+        r = sd_bus_send(NULL, reply, NULL);
+    }
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+/* Conf properties are split between Conf and Conf/Timeouts objects */
+static const sd_bus_vtable *find_conf_property(const char *name) {
+    const sd_bus_vtable *vtables[] = { conf_vtable, conf_to_vtable };
+    for (size_t i = 0; i < sizeof(vtables) / sizeof(*vtables); i++) {
+        for (const sd_bus_vtable *vt = vtables[i]; vt->type != _SD_BUS_VTABLE_END; vt++) {
+            if ((vt->type == _SD_BUS_VTABLE_PROPERTY || vt->type == _SD_BUS_VTABLE_WRITABLE_PROPERTY) && 
+                !strcmp(vt->x.property.member, name)) {
+                
+                return vt;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Size of writable string properties without a setter */
+static size_t conf_str_size(size_t offset) {
+    if (offset == offsetof(conf_t, dev_name)) {
+        return sizeof(conf.dev_name);
+    }
+    if (offset == offsetof(conf_t, dev_opts)) {
+        return sizeof(conf.dev_opts);
+    }
+    if (offset == offsetof(conf_t, screen_path)) {
+        return sizeof(conf.screen_path);
+    }
+    return 0;
+}
+
+/*
+ * Read value without storing it, applying same checks as its setter
+ * and as the module receiving its request (ie: VALIDATE_REQ).
+ * Values equal to current ones are fine: there is just nothing to apply.
+ */
+static int validate_conf_value(sd_bus_message *m, const sd_bus_vtable *vt, sd_bus_error *ret_error) {
+    const char *sig = vt->x.property.signature;
+    const void *userdata = (uint8_t *)&conf + vt->x.property.offset;
+    bool valid = true;
+    int r;
+    if (vt->x.property.set == set_curve) {
+        const void *data = NULL;
+        size_t length = 0;
+        r = sd_bus_message_read_array(m, 'd', &data, &length);
+        curve_upd up = { userdata == conf.regression_points[ON_BATTERY] ? ON_BATTERY : ON_AC, length / sizeof(double), NULL };
+        valid = r < 0 || VALIDATE_REQ(&up);
+    } else if (vt->x.property.set == set_timeouts) {
+        timeout_upd up;
+        memcpy(&up, &timeout_req(userdata)->to, sizeof(up));
+        r = sd_bus_message_read(m, "i", &up.new);
+        valid = r < 0 || VALIDATE_REQ(&up);
+    } else if (vt->x.property.set == set_gamma) {
+        temp_upd up = { .daytime = userdata == &conf.temp[DAY] ? DAY : NIGHT, .smooth = -1 };
+        r = sd_bus_message_read(m, "i", &up.new);
+        valid = r < 0 || up.new == conf.temp[up.daytime] || VALIDATE_REQ(&up);
+    } else if (vt->x.property.set == set_screen_contrib) {
+        contrib_upd up;
+        r = sd_bus_message_read(m, "d", &up.new);
+        valid = r < 0 || up.new == conf.screen_contrib || VALIDATE_REQ(&up);
+    } else if (vt->x.property.set == set_location) {
+        loc_upd up = {{ 0 }};
+        r = sd_bus_message_read(m, "(dd)", &up.new.lat, &up.new.lon);
+        valid = r < 0 || (up.new.lat == state.current_loc.lat && up.new.lon == state.current_loc.lon) || VALIDATE_REQ(&up);
+    } else if (vt->x.property.set == set_event) {
+        const char *event = NULL;
+        evt_upd up = { 0 };
+        r = sd_bus_message_read(m, "s", &event);
+        if (r >= 0) {
+            valid = strlen(event) < sizeof(up.event);
+            if (valid) {
+                strcpy(up.event, event);
+                valid = VALIDATE_REQ(&up);
+            }
+        }
+    } else if (vt->x.property.set == set_gamma_curve) {
+        int curve;
+        r = sd_bus_message_read(m, "i", &curve);
+        valid = r < 0 || (curve >= LINEAR_CURVE && curve < SIZE_CURVES);
+    } else if (!vt->x.property.set && sig[0] == SD_BUS_TYPE_STRING) {
+        const char *str = NULL;
+        r = sd_bus_message_read(m, "s", &str);
+        valid = r < 0 || strlen(str) < conf_str_size(vt->x.property.offset);
+    } else {
+        /* NoAutoCalib and properties without a setter accept any value */
+        r = sd_bus_message_skip(m, sig);
+    }
+    if (!valid) {
+        r = -EINVAL;
+    }
+    if (r < 0) {
+        sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Wrong value for property %s.", vt->x.property.member);
     }
     return r;
 }
+
+static int apply_conf_value(sd_bus_message *m, const sd_bus_vtable *vt, sd_bus_error *ret_error) {
+    void *value = (uint8_t *)&conf + vt->x.property.offset;
+    if (vt->x.property.set) {
+        return vt->x.property.set(sd_bus_message_get_bus(m), sd_bus_message_get_path(m), 
+                                  sd_bus_message_get_interface(m), vt->x.property.member, m, value, ret_error);
+    }
+    
+    /* Properties without a setter are directly stored in conf */
+    if (vt->x.property.signature[0] == SD_BUS_TYPE_STRING) {
+        const char *str = NULL;
+        int r = sd_bus_message_read(m, "s", &str);
+        if (r >= 0) {
+            strncpy(value, str, conf_str_size(vt->x.property.offset) - 1);
+        }
+        return r;
+    }
+    return sd_bus_message_read_basic(m, vt->x.property.signature[0], value);
+}
+
+/*
+ * Publish a copy of a request: same static message may be published
+ * multiple times before being delivered.
+ * During SetMany, requests are batched instead.
+ */
+static void publish_req(const message_t *msg) {
+    if (num_batch_reqs >= 0 && batch_req(msg)) {
+        return;
+    }
+    
+    message_t *copy = malloc(sizeof(message_t));
+    if (copy) {
+        memcpy(copy, msg, sizeof(message_t));
+        m_publish(topics[copy->type], copy, sizeof(message_t), true);
+    }
+}
+
+/* A later request for same topic and key (eg: same property set twice) replaces earlier one */
+static bool batch_req(const message_t *msg) {
+    for (int i = 0; i < num_batch_reqs; i++) {
+        if (batch_reqs[i].type == msg->type && req_key(&batch_reqs[i]) == req_key(msg)) {
+            memcpy(&batch_reqs[i], msg, sizeof(message_t));
+            return true;
+        }
+    }
+    if (num_batch_reqs == MAX_BATCH_REQS) {
+        return false;
+    }
+    memcpy(&batch_reqs[num_batch_reqs++], msg, sizeof(message_t));
+    return true;
+}
+
+/*
+ * Requests only carry a single key (eg: DAY or NIGHT temperature):
+ * for each topic, only requests affecting current state are published,
+ * while others are directly stored in conf, like their module would do on receiving them.
+ * This way, each module recomputes once per topic
+ * (eg: GAMMA rebuilds its schedule and sets temperature once for DayTemp+NightTemp).
+ */
+static void flush_batch(bool apply) {
+    const int n = num_batch_reqs;
+    num_batch_reqs = -1;
+    if (!apply) {
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        if (!batch_publishes(i, n)) {
+            store_req(&batch_reqs[i]);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (batch_publishes(i, n)) {
+            publish_req(&batch_reqs[i]);
+        }
+    }
+}
+
+/* When no request of a topic affects current state, publish the last one anyway, so that its module still recomputes */
+static bool batch_publishes(int idx, int n) {
+    const message_t *msg = &batch_reqs[idx];
+    if (req_is_current(msg)) {
+        return true;
+    }
+    for (int i = 0; i < n; i++) {
+        if (i != idx && batch_reqs[i].type == msg->type && (i > idx || req_is_current(&batch_reqs[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int req_key(const message_t *msg) {
+    switch (msg->type) {
+    case TEMP_REQ:
+        return msg->temp.daytime;
+    case BL_TO_REQ:
+        return msg->to.state * (SIZE_STATES + 1) + msg->to.daytime;   // daytime may be IN_EVENT
+    case DIMMER_TO_REQ:
+    case DPMS_TO_REQ:
+    case SCR_TO_REQ:
+        return msg->to.state;
+    case CURVE_REQ:
+        return msg->curve.state;
+    default:
+        return 0;
+    }
+}
+
+/* Same checks done by modules before acting on a request, instead of just storing it */
+static bool req_is_current(const message_t *msg) {
+    switch (msg->type) {
+    case TEMP_REQ:
+        return msg->temp.daytime == state.day_time;
+    case BL_TO_REQ:
+        return msg->to.state == state.ac_state &&
+               (msg->to.daytime == state.day_time || (state.in_event && msg->to.daytime == IN_EVENT));
+    case DIMMER_TO_REQ:
+    case DPMS_TO_REQ:
+    case SCR_TO_REQ:
+        return msg->to.state == state.ac_state;
+    case CURVE_REQ:
+        return msg->curve.state == state.ac_state;
+    default:
+        return true;
+    }
+}
+
+static void store_req(message_t *msg) {
+    switch (msg->type) {
+    case TEMP_REQ:
+        if (VALIDATE_REQ(&msg->temp)) {
+            conf.temp[msg->temp.daytime] = msg->temp.new;
+        }
+        break;
+    case BL_TO_REQ:
+        if (VALIDATE_REQ(&msg->to)) {
+            conf.timeout[msg->to.state][msg->to.daytime] = msg->to.new;
+        }
+        break;
+    case DIMMER_TO_REQ:
+        if (VALIDATE_REQ(&msg->to)) {
+            conf.dimmer_timeout[msg->to.state] = msg->to.new;
+        }
+        break;
+    case DPMS_TO_REQ:
+        if (VALIDATE_REQ(&msg->to)) {
+            conf.dpms_timeout[msg->to.state] = msg->to.new;
+        }
+        break;
+    case SCR_TO_REQ:
+        if (VALIDATE_REQ(&msg->to)) {
+            conf.screen_timeout[msg->to.state] = msg->to.new;
+        }
+        break;
+    case CURVE_REQ:
+        /* BACKLIGHT refits every curve when receiving the published CURVE_REQ */
+        if (VALIDATE_REQ(&msg->curve)) {
+            memcpy(conf.regression_points[msg->curve.state], msg->curve.regression_points, msg->curve.num_points * sizeof(double));
+            conf.num_points[msg->curve.state] = msg->curve.num_points;
+        }
+        break;
+    default:
+        break;
+    }
+}
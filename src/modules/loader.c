@@ -0,0 +1,281 @@
+#include <fcntl.h>
+#include <glob.h>
+#include <link.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "loader.h"
+
+/*
+ * User modules discovery, validation and disk reads happen on loader_thread;
+ * only the final m_load() (ie: dlopen() running module constructor,
+ * that registers it in libmodule context) happens on main thread.
+ *
+ * modules.d folders are loaded by loader_load_user_modules() before modules are started,
+ * so that user modules receive first updates too (eg: DAYTIME_UPD);
+ * main thread loads a module while loader_thread validates following ones.
+ * Load bus calls are instead served on main loop, one module per loop iteration,
+ * so that bus requests are not stalled meanwhile.
+ */
+enum loader_jobs { LOADER_GLOB, LOADER_FILE };
+
+typedef struct {
+    enum loader_jobs type;
+    char path[PATH_MAX + 1];        // glob pattern for LOADER_GLOB jobs
+    bool valid;                     // set by loader_thread
+    loader_cb cb;                   // optional, for LOADER_FILE jobs
+    void *userdata;
+} loader_job_t;
+
+static void init_user_mod_path(enum CONFIG file, char *filename);
+static int push_job(enum loader_jobs type, const char *path, loader_cb cb, void *userdata);
+static void *loader_thread(void *arg);
+static void expand_glob(const loader_job_t *job);
+static bool validate_module(const char *path);
+static void load_module(loader_job_t *job);
+static void cancel_jobs(void);
+
+static int req_fds[2] = { -1, -1 };         // main loop -> loader_thread
+static int res_fds[2] = { -1, -1 };         // loader_thread -> main loop
+static pthread_t loader_tid;
+static bool running;
+
+MODULE("LOADER");
+
+static void init(void) {
+    if (running) {
+        /* Not autoclosed: jobs still in the pipe are cancelled on destroy() */
+        m_register_fd(res_fds[0], false, NULL);
+    } else {
+        WARN("Failed to init.\n");
+        m_poisonpill(self());
+    }
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return true;
+}
+
+static void destroy(void) {
+    if (req_fds[1] >= 0) {
+        /* loader_thread leaves as soon as it reads EOF */
+        close(req_fds[1]);
+        req_fds[1] = -1;
+    }
+    if (running) {
+        pthread_join(loader_tid, NULL);
+        running = false;
+    }
+    if (req_fds[0] >= 0) {
+        close(req_fds[0]);
+    }
+    if (res_fds[1] >= 0) {
+        close(res_fds[1]);
+        res_fds[1] = -1;
+        cancel_jobs();
+    }
+    if (res_fds[0] >= 0) {
+        close(res_fds[0]);
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD: {
+        loader_job_t *job = NULL;
+        if (read(msg->fd_msg->fd, &job, sizeof(job)) == sizeof(job)) {
+            load_module(job);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/*
+ * Called by main before modules are started: start loader_thread,
+ * then load modules.d modules as soon as they are validated.
+ * loader_thread sends back each glob job once expanded, to mark its end.
+ */
+void loader_load_user_modules(void) {
+    if (pipe2(req_fds, O_CLOEXEC) == 0 && pipe2(res_fds, O_CLOEXEC) == 0 &&
+        pthread_create(&loader_tid, NULL, loader_thread, NULL) == 0) {
+
+        running = true;
+
+        /*
+         * Note that local (ie: placed in $HOME) modules have higher priority,
+         * thus one can override a global module (placed in /usr/share/clight/modules.d/)
+         * by creating a module with same name in $HOME:
+         * jobs are served in order.
+         *
+         * Clight internal modules cannot be overriden.
+         */
+        int pending_globs = 0;
+        char modules_path[PATH_MAX + 1];
+        init_user_mod_path(LOCAL, modules_path);
+        if (push_job(LOADER_GLOB, modules_path, NULL, NULL) == 0) {
+            pending_globs++;
+        }
+        init_user_mod_path(GLOBAL, modules_path);
+        if (push_job(LOADER_GLOB, modules_path, NULL, NULL) == 0) {
+            pending_globs++;
+        }
+
+        loader_job_t *job = NULL;
+        while (pending_globs > 0 && read(res_fds[0], &job, sizeof(job)) == sizeof(job)) {
+            if (job->type == LOADER_GLOB) {
+                pending_globs--;
+                free(job);
+            } else {
+                load_module(job);
+            }
+        }
+    } else {
+        WARN("Failed to start loader thread: user modules won't be loaded.\n");
+    }
+}
+
+/*
+ * Load a user module: it will be validated off main loop,
+ * then loaded; cb, if any, will be called with m_load() result
+ * (-1 if LOADER is stopped before loading it).
+ */
+int loader_load(const char *path, loader_cb cb, void *userdata) {
+    if (!running) {
+        return -1;
+    }
+    return push_job(LOADER_FILE, path, cb, userdata);
+}
+
+static void init_user_mod_path(enum CONFIG file, char *filename) {
+    switch (file) {
+        case LOCAL:
+            if (getenv("XDG_DATA_HOME")) {
+                snprintf(filename, PATH_MAX, "%s/clight/modules.d/*", getenv("XDG_DATA_HOME"));
+            } else {
+                snprintf(filename, PATH_MAX, "%s/.local/share/clight/modules.d/*", getpwuid(getuid())->pw_dir);
+            }
+            break;
+        case GLOBAL:
+            snprintf(filename, PATH_MAX, "%s/modules.d/*", DATADIR);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Jobs are passed by pointer; a pointer write to a pipe is atomic */
+static int push_job(enum loader_jobs type, const char *path, loader_cb cb, void *userdata) {
+    loader_job_t *job = calloc(1, sizeof(loader_job_t));
+    if (!job) {
+        return -1;
+    }
+    job->type = type;
+    strncpy(job->path, path, PATH_MAX);
+    job->cb = cb;
+    job->userdata = userdata;
+    if (write(req_fds[1], &job, sizeof(job)) != sizeof(job)) {
+        free(job);
+        return -1;
+    }
+    return 0;
+}
+
+static void *loader_thread(UNUSED void *arg) {
+    loader_job_t *job = NULL;
+    while (read(req_fds[0], &job, sizeof(job)) == sizeof(job)) {
+        if (job->type == LOADER_GLOB) {
+            expand_glob(job);
+        } else {
+            job->valid = validate_module(job->path);
+        }
+        if (write(res_fds[1], &job, sizeof(job)) != sizeof(job)) {
+            free(job);
+        }
+    }
+    return NULL;
+}
+
+static void expand_glob(const loader_job_t *job) {
+    glob_t gl = {0};
+    if (glob(job->path, GLOB_ERR, NULL, &gl) == 0) {
+        for (int i = 0; i < gl.gl_pathc; i++) {
+            loader_job_t *file_job = calloc(1, sizeof(loader_job_t));
+            if (file_job) {
+                file_job->type = LOADER_FILE;
+                strncpy(file_job->path, gl.gl_pathv[i], PATH_MAX);
+                file_job->valid = validate_module(file_job->path);
+                if (write(res_fds[1], &file_job, sizeof(file_job)) != sizeof(file_job)) {
+                    free(file_job);
+                }
+            }
+        }
+        globfree(&gl);
+    }
+}
+
+/*
+ * Check that path is a shared object built for our ELF class,
+ * then read it ahead in page cache so that dlopen() on main loop won't hit disk.
+ */
+static bool validate_module(const char *path) {
+    bool valid = false;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        ElfW(Ehdr) hdr;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+            !memcmp(hdr.e_ident, ELFMAG, SELFMAG) &&
+            hdr.e_ident[EI_CLASS] == (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32) &&
+            hdr.e_type == ET_DYN) {
+
+            readahead(fd, 0, st.st_size);
+            valid = true;
+        }
+        close(fd);
+    }
+    return valid;
+}
+
+static void load_module(loader_job_t *job) {
+    int r = -1;
+    if (job->valid) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        r = m_load(job->path) == MOD_OK ? 0 : -1;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (r == 0) {
+            const double ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+            INFO("'%s' loaded in %.2lfms.\n", job->path, ms);
+        } else {
+            WARN("'%s' failed to load.\n", job->path);
+        }
+    } else {
+        WARN("'%s' is not a valid module.\n", job->path);
+    }
+    if (job->cb) {
+        job->cb(job->path, r, job->userdata);
+    }
+    free(job);
+}
+
+/*
+ * Called once loader_thread left and res_fds write end was closed:
+ * notify callers of jobs that won't be loaded anymore (eg: pending Load bus calls).
+ */
+static void cancel_jobs(void) {
+    loader_job_t *job = NULL;
+    while (read(res_fds[0], &job, sizeof(job)) == sizeof(job)) {
+        if (job->cb) {
+            job->cb(job->path, -1, job->userdata);
+        }
+        free(job);
+    }
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "bus.h"
+
+typedef void (*loader_cb)(const char *path, int r, void *userdata);
+
+void loader_load_user_modules(void);
+int loader_load(const char *path, loader_cb cb, void *userdata);
@@ -0,0 +1,153 @@
+#include "mirror.h"
+
+#define MIRROR_MAX_MONITORS 16
+
+/*
+ * Mirror of actual backlight levels, kept up to date through
+ * Clightd Backlight.Changed signal, fired for every backlight uevent
+ * (ie: our own SetAll calls but also hotkeys and external tools).
+ */
+typedef struct {
+    char syspath[PATH_MAX + 1];
+    double pct;
+} monitor_t;
+
+static int on_bl_change(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static monitor_t *get_monitor(const char *syspath);
+static bool is_screen_path(const char *syspath);
+
+static sd_bus_slot *slot;
+static monitor_t monitors[MIRROR_MAX_MONITORS];
+static int num_monitors;
+static monitor_t *last_changed;          // monitor that most recently changed
+static double target_pct;                // level of last BL_UPD
+static struct timespec trans_end;        // CLOCK_MONOTONIC estimated end of last BL_UPD smooth transition
+
+MODULE("MIRROR");
+
+static void init(void) {
+    SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Backlight", "org.clightd.clightd.Backlight", "Changed");
+    if (add_match(&args, &slot, on_bl_change) != 0) {
+        WARN("Failed to init.\n");
+        m_poisonpill(self());
+    } else {
+        M_SUB(BL_UPD);
+    }
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return !conf.no_backlight || !conf.no_dimmer;
+}
+
+static void destroy(void) {
+    if (slot) {
+        slot = sd_bus_slot_unref(slot);
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case BL_UPD: {
+        /*
+         * We just called SetAll: every monitor got the new level.
+         * Changed signals will then follow (eg: for each smooth transition step).
+         */
+        bl_upd *up = (bl_upd *)MSG_DATA();
+        for (int i = 0; i < num_monitors; i++) {
+            monitors[i].pct = up->new;
+        }
+        
+        /* Clightd steps by up->step every up->timeout ms */
+        target_pct = up->new;
+        clock_gettime(CLOCK_MONOTONIC, &trans_end);
+        if (up->smooth && up->step > 0 && up->timeout > 0) {
+            const long ms = ceil(fabs(up->new - up->old) / up->step) * up->timeout;
+            trans_end.tv_sec += ms / 1000;
+            trans_end.tv_nsec += (ms % 1000) * 1000000;
+            if (trans_end.tv_nsec >= 1000000000) {
+                trans_end.tv_sec++;
+                trans_end.tv_nsec -= 1000000000;
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/*
+ * Actual backlight level of conf.screen_path monitor if set,
+ * otherwise of the monitor that changed last.
+ * Fallback to last level set by Clight when no Changed signal was received.
+ */
+double mirror_get_bl(void) {
+    if (strlen(conf.screen_path)) {
+        for (int i = 0; i < num_monitors; i++) {
+            if (is_screen_path(monitors[i].syspath)) {
+                return monitors[i].pct;
+            }
+        }
+    } else if (last_changed) {
+        return last_changed->pct;
+    }
+    return state.current_bl_pct;
+}
+
+/*
+ * Level Clight is moving to while a smooth BL_UPD transition is running,
+ * as Changed signals report each of its intermediate steps;
+ * actual level otherwise.
+ */
+double mirror_get_target_bl(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec < trans_end.tv_sec || (now.tv_sec == trans_end.tv_sec && now.tv_nsec < trans_end.tv_nsec)) {
+        return target_pct;
+    }
+    return mirror_get_bl();
+}
+
+static int on_bl_change(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    const char *syspath = NULL;
+    double pct;
+    
+    int r = sd_bus_message_read(m, "sd", &syspath, &pct);
+    if (r >= 0) {
+        monitor_t *mon = get_monitor(syspath);
+        if (mon) {
+            mon->pct = pct;
+            last_changed = mon;
+            DEBUG("Backlight level of %s changed to %.2lf.\n", syspath, pct);
+        }
+    }
+    return 0;
+}
+
+static monitor_t *get_monitor(const char *syspath) {
+    for (int i = 0; i < num_monitors; i++) {
+        if (!strcmp(monitors[i].syspath, syspath)) {
+            return &monitors[i];
+        }
+    }
+    if (num_monitors == MIRROR_MAX_MONITORS) {
+        return NULL;
+    }
+    monitor_t *mon = &monitors[num_monitors++];
+    strncpy(mon->syspath, syspath, sizeof(mon->syspath) - 1);
+    return mon;
+}
+
+/* conf.screen_path may be a full syspath or just its last component (eg: intel_backlight) */
+static bool is_screen_path(const char *syspath) {
+    const char *name = strrchr(conf.screen_path, '/');
+    name = name ? name + 1 : conf.screen_path;
+    
+    const char *sys_name = strrchr(syspath, '/');
+    sys_name = sys_name ? sys_name + 1 : syspath;
+    return !strcmp(name, sys_name);
+}
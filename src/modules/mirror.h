@@ -0,0 +1,6 @@
+#pragma once
+
+#include "bus.h"
+
+double mirror_get_bl(void);
+double mirror_get_target_bl(void);
@@ -1,25 +1,36 @@
 #include "bus.h"
-#include "my_math.h"
+#include "stats.h"
+#include "sleep.h"
+
+#define SCREEN_STABLE_VARIANCE 0.0004       // samples variance (ie: 0.02 stddev) below which screen content is considered stable
+#define SCREEN_MAX_BACKOFF 8                // max multiplier of screen timeout while screen content is stable
 
 static void get_screen_brightness(bool compute);
 static void receive_computing(const msg_t *msg, const void *userdata);
 static void timeout_callback(int old_val, bool is_computing);
 static void pause_screen(bool pause);
+static void reset_screen(bool is_computing);
+static void resume_callback(bool is_computing);
+static void update_backoff(void);
 
 MODULE("SCREEN");
 
-static double *screen_br;
-static int screen_ctr, screen_fd = -1;
+static stats_t screen_br;                   // last conf.screen_samples screen-emitted brightness samples
+static int screen_fd = -1;
+static int sleep_id = -1;
+static int backoff = 1;                     // current multiplier of conf.screen_timeout
 
 DECLARE_MSG(screen_msg, SCR_BL_UPD);
 
 static void init(void) {
-    screen_br = calloc(conf.screen_samples, sizeof(double));
-    if (screen_br) {
+    if (stats_init(&screen_br, conf.screen_samples, 0.0, false) == 0) {
         M_SUB(CONTRIB_REQ);
         M_SUB(SCR_TO_REQ);
         M_SUB(UPOWER_UPD);
         M_SUB(DISPLAY_UPD);
+        M_SUB(SUSPEND_UPD);
+        M_SUB(RESUME_UPD);
+        sleep_id = sleep_register();
     
         /* Start paused if screen timeout for current ac state is <= 0 */
         screen_fd = start_timer(CLOCK_BOOTTIME, 0, conf.screen_timeout[state.ac_state] > 0);
@@ -45,7 +56,8 @@ static bool evaluate(void) {
 }
 
 static void destroy(void) {
-    free(screen_br);
+    sleep_deregister(sleep_id);
+    stats_free(&screen_br);
     if (screen_fd >= 0) {
         close(screen_fd);
     }
@@ -54,24 +66,50 @@ static void destroy(void) {
 static void get_screen_brightness(bool compute) {
     SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Screen", "org.clightd.clightd.Screen", "GetEmittedBrightness");
     
-    if (call(&screen_br[screen_ctr], "d", &args, "ss", state.display, state.xauthority) == 0) {
-        screen_ctr = (screen_ctr + 1) % conf.screen_samples;
+    double br;
+    if (call(&br, "d", &args, "ss", state.display, state.xauthority) == 0) {
+        stats_push(&screen_br, br);
     
         if (compute) {
             screen_msg.bl.old = state.screen_comp;
-            state.screen_comp = compute_average(screen_br, conf.screen_samples) * conf.screen_contrib;
+            state.screen_comp = stats_mean(&screen_br) * conf.screen_contrib;
             if (screen_msg.bl.old != state.screen_comp) {
                 screen_msg.bl.new = state.screen_comp;
                 M_PUB(&screen_msg);
             }
             DEBUG("Average screen-emitted brightness: %lf.\n", state.screen_comp);
-        } else if (screen_ctr + 1 == conf.screen_samples) {
+            update_backoff();
+            if (backoff == 0) {
+                /* Screen content started changing: immediately sample again */
+                backoff = 1;
+                set_timeout(0, 1, screen_fd, 0);
+                return;
+            }
+        } else if (stats_full(&screen_br)) {
             /* Bucket filled! Start computing! */
             DEBUG("Start compensating for screen-emitted brightness.\n");
             m_become(computing);
         }
     }
-    set_timeout(conf.screen_timeout[state.ac_state], 0, screen_fd, 0);
+    set_timeout(conf.screen_timeout[state.ac_state] * backoff, 0, screen_fd, 0);
+}
+
+/*
+ * While screen content is stable, sampling it often is useless:
+ * double sampling interval up to SCREEN_MAX_BACKOFF times screen timeout.
+ * As soon as variance rises, go back to normal interval;
+ * backoff is set to 0 to let caller sample immediately.
+ */
+static void update_backoff(void) {
+    if (stats_variance(&screen_br) > SCREEN_STABLE_VARIANCE) {
+        if (backoff > 1) {
+            DEBUG("Screen content changing; back to normal sampling interval.\n");
+            backoff = 0;
+        }
+    } else if (backoff < SCREEN_MAX_BACKOFF) {
+        backoff *= 2;
+        DEBUG("Screen content stable; sampling every %d seconds.\n", conf.screen_timeout[state.ac_state] * backoff);
+    }
 }
 
 static void receive(const msg_t *msg, UNUSED const void *userdata) {
@@ -88,6 +126,13 @@ static void receive(const msg_t *msg, UNUSED const void *userdata) {
     case DISPLAY_UPD:
         pause_screen(state.display_state);
         break;
+    case SUSPEND_UPD:
+        set_timeout(0, 0, screen_fd, 0);
+        sleep_ack(sleep_id);
+        break;
+    case RESUME_UPD:
+        resume_callback(false);
+        break;
     case SCR_TO_REQ: {
         timeout_upd *up = (timeout_upd *)MSG_DATA();
         if (VALIDATE_REQ(up)) {
@@ -125,6 +170,13 @@ static void receive_computing(const msg_t *msg, UNUSED const void *userdata) {
     case DISPLAY_UPD:
         pause_screen(state.display_state);
         break;
+    case SUSPEND_UPD:
+        set_timeout(0, 0, screen_fd, 0);
+        sleep_ack(sleep_id);
+        break;
+    case RESUME_UPD:
+        resume_callback(true);
+        break;
     case SCR_TO_REQ: {
         timeout_upd *up = (timeout_upd *)MSG_DATA();
         if (VALIDATE_REQ(up)) {
@@ -143,7 +195,7 @@ static void receive_computing(const msg_t *msg, UNUSED const void *userdata) {
             conf.screen_contrib = up->new;
             /* Recompute current screen compensation */
             screen_msg.bl.old = state.screen_comp;
-            state.screen_comp = compute_average(screen_br, conf.screen_samples) * conf.screen_contrib;
+            state.screen_comp = stats_mean(&screen_br) * conf.screen_contrib;
             if (screen_msg.bl.old != state.screen_comp) {
                 screen_msg.bl.new = state.screen_comp;
                 M_PUB(&screen_msg);
@@ -161,7 +213,8 @@ static void receive_computing(const msg_t *msg, UNUSED const void *userdata) {
 }
 
 static void timeout_callback(int old_val, bool is_computing) {
-    reset_timer(screen_fd, old_val, conf.screen_timeout[state.ac_state]);
+    reset_timer(screen_fd, old_val * backoff, conf.screen_timeout[state.ac_state]);
+    backoff = 1;
     /* 
      * A paused timeout has been set; this means user does not want 
      * SCREEN to work in current AC state.
@@ -169,22 +222,41 @@ static void timeout_callback(int old_val, bool is_computing) {
      * and reset all screen_br values.
      */
     if (conf.screen_timeout[state.ac_state] <= 0) {
-        state.screen_comp = 0.0;
-        memset(screen_br, 0, conf.screen_samples * sizeof(double));
-        screen_ctr = 0;
-        
-        if (is_computing) {
-            m_unbecome();
-        }
+        reset_screen(is_computing);
+    }
+}
+
+static void reset_screen(bool is_computing) {
+    state.screen_comp = 0.0;
+    stats_reset(&screen_br);
+    backoff = 1;
+    
+    if (is_computing) {
+        m_unbecome();
+    }
+}
+
+/*
+ * Screen content before suspend is meaningless now:
+ * drop old samples and immediately start sampling again.
+ */
+static void resume_callback(bool is_computing) {
+    reset_screen(is_computing);
+    if (conf.screen_timeout[state.ac_state] > 0) {
+        set_timeout(0, 1, screen_fd, 0);
     }
 }
 
 static void pause_screen(bool pause) {
     if (pause) {
-        /* Stop capturing snapshots while dimmed or dpms or conf.screen_contrib is 0 */
+        /* Stop capturing snapshots while user is idle (dimmed or dpms) or conf.screen_contrib is 0 */
         m_deregister_fd(screen_fd);
     } else {
-        /* Resume capturing */
+        /* Resume capturing: user is back, screen content has likely changed; sample it right now */
         m_register_fd(screen_fd, false, NULL);
+        backoff = 1;
+        if (conf.screen_timeout[state.ac_state] > 0) {
+            set_timeout(0, 1, screen_fd, 0);
+        }
     }
 }
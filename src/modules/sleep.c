@@ -0,0 +1,184 @@
+#include <inttypes.h>
+#include "sleep.h"
+
+#define SLEEP_MAX_CLIENTS 8
+#define SLEEP_ACK_TIMEOUT 2                   // seconds to wait for clients acks before letting system sleep anyway
+#define SLEEP_LATENCY_WINDOW 60               // seconds after resume within which a backlight set counts as resume latency
+
+/*
+ * Modules that must disarm their timers before sleep register themselves
+ * and ack each SUSPEND_UPD once handled: delay lock is only released
+ * when every registered module acked (or SLEEP_ACK_TIMEOUT expired).
+ */
+static int on_prepare_for_sleep(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static void check_acks(void);
+static void take_delay_lock(void);
+static void release_delay_lock(void);
+
+static sd_bus_slot *slot;
+static int lock_fd = -1;
+static int ack_fd = -1;                       // SLEEP_ACK_TIMEOUT timer
+static uint32_t registered;                   // bitmask of registered clients
+static uint32_t acked;                        // bitmask of clients that acked current suspend
+static struct timespec resume_ts;             // when system was resumed
+static bool measuring;                        // whether we are waiting for first backlight level set after resume
+
+DECLARE_MSG(suspend_msg, SUSPEND_UPD);
+DECLARE_MSG(resume_msg, RESUME_UPD);
+
+MODULE("SLEEP");
+
+static void init(void) {
+    SYSBUS_ARG(args, "org.freedesktop.login1", "/org/freedesktop/login1", "org.freedesktop.login1.Manager", "PrepareForSleep");
+    if (add_match(&args, &slot, on_prepare_for_sleep) != 0) {
+        WARN("Failed to init.\n");
+        m_poisonpill(self());
+    } else {
+        M_SUB(BL_UPD);
+        M_SUB(DISPLAY_UPD);
+        ack_fd = start_timer(CLOCK_MONOTONIC, 0, 0);
+        m_register_fd(ack_fd, true, NULL);
+        take_delay_lock();
+    }
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return true;
+}
+
+static void destroy(void) {
+    if (slot) {
+        slot = sd_bus_slot_unref(slot);
+    }
+    release_delay_lock();
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD:
+        read_timer(msg->fd_msg->fd);
+        if (lock_fd >= 0) {
+            WARN("Not every module acked suspend in %ds; letting system sleep.\n", SLEEP_ACK_TIMEOUT);
+            release_delay_lock();
+        }
+        break;
+    case BL_UPD:
+        if (measuring) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            const uint64_t latency = (now.tv_sec - resume_ts.tv_sec) * 1000 + (now.tv_nsec - resume_ts.tv_nsec) / 1000000;
+            measuring = false;
+            /* Backlight was not set right after resume (eg: inhibited or no capture due): not a resume latency */
+            if (latency <= SLEEP_LATENCY_WINDOW * 1000) {
+                state.resume_latency = latency;
+                INFO("Backlight level set %" PRIu64 "ms after resume.\n", state.resume_latency);
+            } else {
+                DEBUG("Backlight level set %" PRIu64 "ms after resume; not a resume latency.\n", latency);
+            }
+        }
+        break;
+    case DISPLAY_UPD: {
+        /* Display got dimmed or switched off before any backlight set after resume */
+        const display_upd *up = (display_upd *)MSG_DATA();
+        if (up->new != DISPLAY_ON) {
+            measuring = false;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/*
+ * Callback on logind PrepareForSleep signal:
+ * its argument is true when going to sleep, false when resuming.
+ */
+static int on_prepare_for_sleep(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    int going_to_sleep;
+    int r = sd_bus_message_read(m, "b", &going_to_sleep);
+    if (r < 0 || going_to_sleep == state.suspended) {
+        return 0;
+    }
+
+    if (going_to_sleep) {
+        INFO("Suspending.\n");
+        measuring = false;
+        acked = 0;
+        set_timeout(SLEEP_ACK_TIMEOUT, 0, ack_fd, 0);
+    } else {
+        INFO("Resumed.\n");
+        clock_gettime(CLOCK_MONOTONIC, &resume_ts);
+        measuring = !conf.no_backlight;
+        take_delay_lock();
+    }
+
+    message_t *msg = going_to_sleep ? &suspend_msg : &resume_msg;
+    msg->suspend.old = state.suspended;
+    state.suspended = going_to_sleep;
+    msg->suspend.new = state.suspended;
+    M_PUB(msg);
+    if (going_to_sleep) {
+        /* No one to wait for */
+        check_acks();
+    }
+    return 0;
+}
+
+int sleep_register(void) {
+    for (int i = 0; i < SLEEP_MAX_CLIENTS; i++) {
+        if (!(registered & (1 << i))) {
+            registered |= 1 << i;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void sleep_deregister(int id) {
+    if (id >= 0 && id < SLEEP_MAX_CLIENTS) {
+        registered &= ~(1 << id);
+        check_acks();
+    }
+}
+
+/* Called by registered modules once they handled SUSPEND_UPD */
+void sleep_ack(int id) {
+    if (id >= 0 && id < SLEEP_MAX_CLIENTS) {
+        acked |= 1 << id;
+        check_acks();
+    }
+}
+
+static void check_acks(void) {
+    if (state.suspended && lock_fd >= 0 && (acked & registered) == registered) {
+        DEBUG("Every module acked suspend.\n");
+        set_timeout(0, 0, ack_fd, 0);
+        release_delay_lock();
+    }
+}
+
+/*
+ * Delay inhibitor lock: logind waits for us to release it
+ * (up to InhibitDelayMaxSec) before actually suspending.
+ */
+static void take_delay_lock(void) {
+    if (lock_fd == -1) {
+        SYSBUS_ARG(args, "org.freedesktop.login1", "/org/freedesktop/login1", "org.freedesktop.login1.Manager", "Inhibit");
+        if (call(&lock_fd, "h", &args, "ssss", "sleep", "Clight", "Disarming timers before sleep", "delay") != 0) {
+            lock_fd = -1;
+            DEBUG("Failed to take sleep delay lock.\n");
+        }
+    }
+}
+
+static void release_delay_lock(void) {
+    if (lock_fd >= 0) {
+        close(lock_fd);
+        lock_fd = -1;
+    }
+}
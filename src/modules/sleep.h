@@ -0,0 +1,7 @@
+#pragma once
+
+#include "bus.h"
+
+int sleep_register(void);
+void sleep_deregister(int id);
+void sleep_ack(int id);
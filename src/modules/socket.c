@@ -0,0 +1,260 @@
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "bus.h"
+
+#define SOCKET_MAX_CLIENTS 16
+
+/*
+ * Local clients (eg: status bars) follow high-rate updates through
+ * a SOCK_SEQPACKET unix socket, without any bus roundtrip:
+ * fixed-size socket_req/socket_upd records (see public.h) are exchanged,
+ * one per packet.
+ */
+typedef struct {
+    int fd;                                 // -1 when slot is free
+    bool subscribed;
+    uint64_t dropped;                       // records dropped because client was not reading fast enough
+} client_t;
+
+static bool is_socket_live(void);
+static void accept_client(void);
+static void client_recv(client_t *c);
+static bool validate_client_req(message_t *msg);
+static void forward_upd(const message_t *msg);
+static void drop_client(client_t *c);
+static client_t *find_client(int fd);
+
+static client_t clients[SOCKET_MAX_CLIENTS];
+static int listen_fd = -1;
+static struct sockaddr_un addr;
+
+MODULE("SOCKET");
+
+static void init(void) {
+    for (int i = 0; i < SOCKET_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/clight.sock", getenv("XDG_RUNTIME_DIR"));
+    if (is_socket_live()) {
+        WARN("%s is in use by another instance.\n", addr.sun_path);
+        m_poisonpill(self());
+        return;
+    }
+    /* Remove any stale socket left by a crashed instance */
+    unlink(addr.sun_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd >= 0 &&
+        bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+        listen(listen_fd, SOCKET_MAX_CLIENTS) == 0) {
+
+        m_register_fd(listen_fd, true, NULL);
+        /* Subscribe to every update topic (requests matching them as regexes are filtered out in receive()) */
+        for (enum mod_msg_types t = LOC_UPD; t < MSGS_SIZE; t++) {
+            if (IS_UPD(t)) {
+                m_subscribe(topics[t]);
+            }
+        }
+        DEBUG("Listening on %s.\n", addr.sun_path);
+    } else {
+        WARN("Failed to init: %s.\n", strerror(errno));
+        if (listen_fd >= 0) {
+            close(listen_fd);
+            listen_fd = -1;
+        }
+        m_poisonpill(self());
+    }
+}
+
+static bool check(void) {
+    return getenv("XDG_RUNTIME_DIR") != NULL;
+}
+
+static bool evaluate(void) {
+    return conf.control_socket;
+}
+
+static void destroy(void) {
+    /* Only remove our own socket */
+    if (listen_fd >= 0) {
+        for (int i = 0; i < SOCKET_MAX_CLIENTS; i++) {
+            drop_client(&clients[i]);
+        }
+        unlink(addr.sun_path);
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    const enum mod_msg_types type = MSG_TYPE();
+    switch (type) {
+    case FD_UPD:
+        if (msg->fd_msg->fd == listen_fd) {
+            accept_client();
+        } else {
+            client_t *c = find_client(msg->fd_msg->fd);
+            if (c) {
+                client_recv(c);
+            }
+        }
+        break;
+    default:
+        if (IS_UPD(type)) {
+            forward_upd((const message_t *)msg->ps_msg->message);
+        }
+        break;
+    }
+}
+
+/* Whether someone is listening on our socket path */
+static bool is_socket_live(void) {
+    bool live = false;
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd >= 0) {
+        live = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        close(fd);
+    }
+    return live;
+}
+
+static void accept_client(void) {
+    const int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    client_t *c = find_client(-1);
+    if (!c) {
+        WARN("Too many clients; refusing connection.\n");
+        close(fd);
+        return;
+    }
+    c->fd = fd;
+    c->subscribed = false;
+    c->dropped = 0;
+    m_register_fd(fd, true, NULL);
+    DEBUG("New client connected (fd %d).\n", fd);
+}
+
+static void client_recv(client_t *c) {
+    socket_req req;
+    const ssize_t len = recv(c->fd, &req, sizeof(req), 0);
+    if (len <= 0) {
+        if (len == 0 || (errno != EAGAIN && errno != EINTR)) {
+            drop_client(c);
+        }
+        return;
+    }
+    if (len != sizeof(req)) {
+        DEBUG("Wrong record size: %zd (expected %zu).\n", len, sizeof(req));
+        return;
+    }
+
+    switch (req.cmd) {
+    case SOCKET_REQ:
+        if (validate_client_req(&req.msg)) {
+            message_t *copy = malloc(sizeof(message_t));
+            if (copy) {
+                memcpy(copy, &req.msg, sizeof(message_t));
+                m_publish(topics[copy->type], copy, sizeof(message_t), true);
+            }
+        } else {
+            DEBUG("Wrong request (type %d).\n", req.msg.type);
+        }
+        break;
+    case SOCKET_SUBSCRIBE:
+        c->subscribed = true;
+        break;
+    case SOCKET_UNSUBSCRIBE:
+        c->subscribed = false;
+        break;
+    default:
+        DEBUG("Wrong command: %d.\n", req.cmd);
+        break;
+    }
+}
+
+/*
+ * Unlike bus API, clients fill raw records:
+ * check fields that modules use as array indexes or strings before publishing them;
+ * every other field is checked by module VALIDATE_REQ() as usual.
+ */
+static bool validate_client_req(message_t *msg) {
+    const enum mod_msg_types type = msg->type;
+    switch (type) {
+    case CURVE_REQ:
+        /* It carries a pointer into client address space */
+        return false;
+    case SUNRISE_REQ:
+    case SUNSET_REQ:
+        msg->event.event[sizeof(msg->event.event) - 1] = '\0';
+        return true;
+    case TEMP_REQ:
+        return msg->temp.daytime == -1 || (msg->temp.daytime >= DAY && msg->temp.daytime < SIZE_STATES);
+    case BL_TO_REQ:
+        if (msg->to.daytime != -1 && (msg->to.daytime < DAY || msg->to.daytime > IN_EVENT)) {
+            return false;
+        }
+        /* fallthrough */
+    case DIMMER_TO_REQ:
+    case DPMS_TO_REQ:
+    case SCR_TO_REQ:
+        return msg->to.state == -1 || (msg->to.state >= ON_AC && msg->to.state < SIZE_AC);
+    case UPOWER_REQ:
+        return msg->upower.new >= ON_AC && msg->upower.new < SIZE_AC;
+    case DISPLAY_REQ:
+        return msg->display.new >= DISPLAY_ON && msg->display.new < DISPLAY_SIZE;
+    default:
+        return IS_REQ(type);
+    }
+}
+
+/*
+ * Record is built once and sent to every subscribed client.
+ * Never block the main loop on a slow client: when its socket buffer is full,
+ * the record is dropped for that client only.
+ */
+static void forward_upd(const message_t *msg) {
+    static socket_upd upd;
+    bool built = false;
+
+    for (int i = 0; i < SOCKET_MAX_CLIENTS; i++) {
+        client_t *c = &clients[i];
+        if (c->fd < 0 || !c->subscribed) {
+            continue;
+        }
+        if (!built) {
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            upd.ts = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+            memcpy(&upd.msg, msg, sizeof(message_t));
+            built = true;
+        }
+        if (send(c->fd, &upd, sizeof(upd), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            if (errno == EAGAIN) {
+                c->dropped++;
+            } else {
+                drop_client(c);
+            }
+        }
+    }
+}
+
+static void drop_client(client_t *c) {
+    if (c->fd >= 0) {
+        DEBUG("Client disconnected (fd %d, %" PRIu64 " dropped records).\n", c->fd, c->dropped);
+        /* Registered with autoclose */
+        m_deregister_fd(c->fd);
+        c->fd = -1;
+    }
+}
+
+static client_t *find_client(int fd) {
+    for (int i = 0; i < SOCKET_MAX_CLIENTS; i++) {
+        if (clients[i].fd == fd) {
+            return &clients[i];
+        }
+    }
+    return NULL;
+}
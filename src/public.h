@@ -16,6 +16,9 @@
 
 #define ASSERT_MSG(type);           _Static_assert(type >= LOC_UPD && type < MSGS_SIZE, "Wrong MSG type.");
 
+#define IS_UPD(type)                (((type) >= LOC_UPD && (type) < LOCATION_REQ) || ((type) > SIMULATE_REQ && (type) < MSGS_SIZE))
+#define IS_REQ(type)                ((type) >= LOCATION_REQ && (type) <= SIMULATE_REQ)
+
 #define MSG_TYPE()                  msg->is_pubsub ? (msg->ps_msg->type == USER ? ((message_t *)msg->ps_msg->message)->type : SYSTEM_UPD) : FD_UPD
 #define MSG_DATA()                  ((uint8_t *)msg->ps_msg->message + offsetof(message_t, loc)) // offsetof any of the internal data structure to actually account for padding
 
@@ -92,7 +95,10 @@ enum mod_msg_types {
     CURVE_REQ,          // Publish to set a new backlight curve for given ac state
     NO_AUTOCALIB_REQ,   // Publish to set a new no_autocalib value for BACKLIGHT
     CONTRIB_REQ,        // Publish to set a new screen-emitted compensation value
-    SIMULATE_REQ,       // Publish to simulate user activity (resetting both dimmer and dpms timeouts)
+    SIMULATE_REQ,       // Publish to simulate user activity (resetting IDLER client, thus both dimmer and dpms timeouts)
+    /* New topics are appended here, so that values above stay stable for already built user modules */
+    SUSPEND_UPD,        // Subscribe to be notified right before system suspends
+    RESUME_UPD,         // Subscribe to be notified right after system resumes
     MSGS_SIZE
 };
 
@@ -180,6 +186,11 @@ typedef struct {
     double new;                 // Mandatory for requests
 } contrib_upd;
 
+typedef struct {
+    bool old;                   // Valued in updates
+    bool new;                   // Valued in updates: true when suspending, false when resuming
+} suspend_upd;
+
 typedef struct {
     const enum mod_msg_types type;
     union {
@@ -196,9 +207,30 @@ typedef struct {
         bl_upd bl;              /* AMBIENT_BR_UPD/BL_UPD/KBD_BL_UPD/SCR_BL_UPD/BL_REQ/KBD_BL_REQ */
         contrib_upd contrib;    /* CONTRIB_REQ */
         capture_upd capture;    /* CAPTURE_REQ */
+        suspend_upd suspend;    /* SUSPEND_UPD/RESUME_UPD */
     };
 } message_t;
 
+/** Control socket records **/
+
+enum socket_cmds {
+    SOCKET_REQ,                 // Publish msg; msg.type must be a *_REQ topic (but CURVE_REQ)
+    SOCKET_SUBSCRIBE,           // Start receiving a socket_upd record for each *_UPD message
+    SOCKET_UNSUBSCRIBE          // Stop receiving socket_upd records
+};
+
+/* Sent by clients to $XDG_RUNTIME_DIR/clight.sock (SOCK_SEQPACKET): one record per packet */
+typedef struct {
+    enum socket_cmds cmd;
+    message_t msg;              // Only meaningful for SOCKET_REQ
+} socket_req;
+
+/* Streamed by Clight to subscribed clients: one record per packet */
+typedef struct {
+    uint64_t ts;                // CLOCK_REALTIME nanoseconds when update was forwarded
+    message_t msg;
+} socket_upd;
+
 /** PubSub Topics **/
 extern const char *topics[];
 
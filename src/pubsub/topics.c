@@ -31,6 +31,8 @@ const char *topics[] = {
     "ReqCurve",
     "ReqAutocalib",
     "ReqContrib",
-    "ReqSimulate"
+    "ReqSimulate",
+    "Suspended",
+    "Resumed"
 };
 _Static_assert(sizeof(topics) / sizeof(*topics) == MSGS_SIZE, "Undefined topic.");
@@ -0,0 +1,470 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <linux/videodev2.h>
+#include "camera.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CAMERA_X86_SIMD
+#endif
+
+#define CAMERA_NUM_BUFS 2                   // number of mmap'd streaming buffers requested to the driver
+#define CAMERA_FRAME_TIMEOUT 2              // seconds to wait for a frame before giving up
+#define CAMERA_DUMP_ENV "CLIGHT_FRAME_DUMP" // directory where captured frames are dumped, if set
+
+struct buffer {
+    void *start;
+    size_t length;
+};
+
+typedef uint64_t (*luma_sum_fn)(const uint8_t *row, size_t len, bool packed);
+
+/* Capture running on capture_thread, off main loop */
+typedef struct {
+    pthread_t tid;
+    int fds[2];                             // capture_thread -> caller: capture completed
+    bool running;
+    char dev_name[PATH_MAX + 1];
+    int num_frames;
+    double *intensity;
+    int r;
+} capture_job_t;
+
+static int xioctl(int fd, unsigned long req, void *arg);
+static int camera_set_format(int fd, struct v4l2_format *fmt);
+static int camera_init_buffers(int fd, struct buffer *bufs, unsigned int *num_bufs);
+static int camera_read_frame(int fd, const struct v4l2_format *fmt, const struct buffer *bufs,
+                             unsigned int num_bufs, double *br);
+static void camera_free_buffers(struct buffer *bufs, unsigned int num_bufs);
+static uint64_t luma_sum_scalar(const uint8_t *row, size_t len, bool packed);
+#ifdef CAMERA_X86_SIMD
+static uint64_t luma_sum_sse2(const uint8_t *row, size_t len, bool packed);
+static uint64_t luma_sum_avx2(const uint8_t *row, size_t len, bool packed);
+#endif
+static luma_sum_fn get_luma_sum(void);
+static void *capture_thread(void *arg);
+static void dump_frame(const uint8_t *data, size_t size, const struct v4l2_format *fmt);
+
+static luma_sum_fn luma_sum;
+static capture_job_t job = { .fds = { -1, -1 } };
+
+/*
+ * Capture num_frames frames from dev_name V4L2 device, storing
+ * each frame's mean luminance (normalized between 0-1) in intensity.
+ * Device is opened and closed on each call, to avoid
+ * keeping webcam led switched on between captures.
+ * Returns 0 on success, -1 on error (eg: device is not a webcam).
+ */
+int camera_capture(const char *dev_name, int num_frames, double *intensity) {
+    char path[PATH_MAX + 1] = {0};
+    struct buffer bufs[CAMERA_NUM_BUFS] = {{0}};
+    unsigned int num_bufs = 0;
+    struct v4l2_format fmt = {0};
+    int r = -1;
+
+    if (!strlen(dev_name)) {
+        dev_name = "video0";
+    }
+    if (dev_name[0] == '/') {
+        strncpy(path, dev_name, PATH_MAX);
+    } else {
+        snprintf(path, PATH_MAX, "/dev/%s", dev_name);
+    }
+
+    int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        DEBUG("Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (camera_set_format(fd, &fmt) == 0 && camera_init_buffers(fd, bufs, &num_bufs) == 0) {
+        enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if (xioctl(fd, VIDIOC_STREAMON, &type) == 0) {
+            r = 0;
+            for (int i = 0; i < num_frames && r == 0; i++) {
+                r = camera_read_frame(fd, &fmt, bufs, num_bufs, &intensity[i]);
+            }
+            xioctl(fd, VIDIOC_STREAMOFF, &type);
+        }
+    }
+    camera_free_buffers(bufs, num_bufs);
+    close(fd);
+    return r;
+}
+
+/*
+ * Start an asynchronous camera_capture() on a thread:
+ * returns a fd that becomes readable when capture is completed
+ * (then call camera_capture_finish()), or -1 on error.
+ * Returned fd is always the same: callers can register it once.
+ */
+int camera_capture_start(const char *dev_name, int num_frames) {
+    if (job.running || num_frames <= 0) {
+        return -1;
+    }
+    if (job.fds[0] == -1 && pipe2(job.fds, O_CLOEXEC) == -1) {
+        return -1;
+    }
+    job.intensity = calloc(num_frames, sizeof(double));
+    if (!job.intensity) {
+        return -1;
+    }
+    if (!luma_sum) {
+        /* Select kernel before capture_thread uses it */
+        camera_set_kernel(CAMERA_KERNEL_AUTO);
+    }
+    strncpy(job.dev_name, dev_name, PATH_MAX);
+    job.num_frames = num_frames;
+    job.r = -1;
+    if (pthread_create(&job.tid, NULL, capture_thread, NULL) != 0) {
+        free(job.intensity);
+        job.intensity = NULL;
+        return -1;
+    }
+    job.running = true;
+    return job.fds[0];
+}
+
+/*
+ * Collect result of capture started by camera_capture_start().
+ * Returns -1 if capture failed or if it was started for a different number of frames.
+ */
+int camera_capture_finish(double *intensity, int num_frames) {
+    if (!job.running) {
+        return -1;
+    }
+    uint8_t done;
+    if (read(job.fds[0], &done, sizeof(done)) != sizeof(done)) {
+        /* Should never happen: let pthread_join wait for capture_thread */
+        DEBUG("Failed to read capture result.\n");
+    }
+    pthread_join(job.tid, NULL);
+    job.running = false;
+    
+    int r = job.r;
+    if (r == 0 && num_frames == job.num_frames && intensity) {
+        memcpy(intensity, job.intensity, num_frames * sizeof(double));
+    } else {
+        r = -1;
+    }
+    free(job.intensity);
+    job.intensity = NULL;
+    return r;
+}
+
+/* Wait for any running capture, then release resources */
+void camera_capture_stop(void) {
+    if (job.running) {
+        camera_capture_finish(NULL, 0);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (job.fds[i] >= 0) {
+            close(job.fds[i]);
+            job.fds[i] = -1;
+        }
+    }
+}
+
+/*
+ * Force a luminance kernel, mostly useful to compare them.
+ * Returns -1 if kernel is not supported by current CPU.
+ */
+int camera_set_kernel(enum camera_kernels kernel) {
+    switch (kernel) {
+    case CAMERA_KERNEL_AUTO:
+        luma_sum = get_luma_sum();
+        return 0;
+    case CAMERA_KERNEL_SCALAR:
+        luma_sum = luma_sum_scalar;
+        return 0;
+#ifdef CAMERA_X86_SIMD
+    case CAMERA_KERNEL_SSE2:
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2")) {
+            luma_sum = luma_sum_sse2;
+            return 0;
+        }
+        return -1;
+    case CAMERA_KERNEL_AVX2:
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            luma_sum = luma_sum_avx2;
+            return 0;
+        }
+        return -1;
+#endif
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Compute mean luminance of a single frame, normalized between 0-1.
+ * Supported formats: YUYV (packed, luma on even bytes), NV12 (luma plane first) and GREY.
+ * Returns -1.0 for unsupported formats or truncated frames.
+ */
+double camera_frame_brightness(const uint8_t *data, size_t size, uint32_t pixelformat, int width, int height, int stride) {
+    if (width <= 0 || height <= 0 || stride < 0) {
+        return -1.0;
+    }
+
+    size_t row_len;
+    bool packed = false;
+    switch (pixelformat) {
+    case V4L2_PIX_FMT_YUYV:
+        row_len = 2 * width;
+        packed = true;
+        break;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_GREY:
+        row_len = width;
+        break;
+    default:
+        return -1.0;
+    }
+
+    size_t row_stride = stride;
+    if (row_stride < row_len) {
+        row_stride = row_len;
+    }
+    if (size < row_stride * (height - 1) + row_len) {
+        return -1.0;
+    }
+
+    if (!luma_sum) {
+        camera_set_kernel(CAMERA_KERNEL_AUTO);
+    }
+
+    uint64_t sum = 0;
+    for (int i = 0; i < height; i++) {
+        sum += luma_sum(data + i * row_stride, row_len, packed);
+    }
+    return (double)sum / ((double)width * height * 255.0);
+}
+
+static int xioctl(int fd, unsigned long req, void *arg) {
+    int r;
+    do {
+        r = ioctl(fd, req, arg);
+    } while (r == -1 && errno == EINTR);
+    return r;
+}
+
+/*
+ * Keep current device format if we can compute its luminance,
+ * otherwise ask for YUYV, that is supported by almost every UVC webcam.
+ */
+static int camera_set_format(int fd, struct v4l2_format *fmt) {
+    struct v4l2_capability caps = {0};
+    if (xioctl(fd, VIDIOC_QUERYCAP, &caps) == -1 ||
+        !(caps.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+        !(caps.capabilities & V4L2_CAP_STREAMING)) {
+
+        DEBUG("Device does not support video capture streaming.\n");
+        return -1;
+    }
+
+    fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(fd, VIDIOC_G_FMT, fmt) == -1) {
+        return -1;
+    }
+
+    switch (fmt->fmt.pix.pixelformat) {
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_GREY:
+        return 0;
+    default:
+        fmt->fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+        fmt->fmt.pix.field = V4L2_FIELD_ANY;
+        if (xioctl(fd, VIDIOC_S_FMT, fmt) == -1 || fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV) {
+            DEBUG("Unsupported pixel format.\n");
+            return -1;
+        }
+        return 0;
+    }
+}
+
+static int camera_init_buffers(int fd, struct buffer *bufs, unsigned int *num_bufs) {
+    struct v4l2_requestbuffers req = {0};
+    req.count = CAMERA_NUM_BUFS;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd, VIDIOC_REQBUFS, &req) == -1 || req.count == 0) {
+        DEBUG("Failed to request mmap buffers: %s\n", strerror(errno));
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < req.count && i < CAMERA_NUM_BUFS; i++) {
+        struct v4l2_buffer buf = {0};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buf) == -1) {
+            return -1;
+        }
+
+        bufs[i].start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+        if (bufs[i].start == MAP_FAILED) {
+            bufs[i].start = NULL;
+            return -1;
+        }
+        bufs[i].length = buf.length;
+        *num_bufs = i + 1;
+
+        if (xioctl(fd, VIDIOC_QBUF, &buf) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int camera_read_frame(int fd, const struct v4l2_format *fmt, const struct buffer *bufs,
+                             unsigned int num_bufs, double *br) {
+    struct v4l2_buffer buf = {0};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+
+    int r;
+    do {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        struct timeval tv = { CAMERA_FRAME_TIMEOUT, 0 };
+        r = select(fd + 1, &fds, NULL, NULL, &tv);
+        if (r == 0) {
+            DEBUG("Timed out waiting for a frame.\n");
+            return -1;
+        }
+        if (r > 0) {
+            r = xioctl(fd, VIDIOC_DQBUF, &buf);
+        }
+    } while (r == -1 && (errno == EINTR || errno == EAGAIN));
+
+    /* Driver may grant fewer buffers than requested: only num_bufs are mapped */
+    if (r == -1 || buf.index >= num_bufs) {
+        return -1;
+    }
+
+    if (getenv(CAMERA_DUMP_ENV)) {
+        dump_frame(bufs[buf.index].start, buf.bytesused, fmt);
+    }
+    *br = camera_frame_brightness(bufs[buf.index].start, buf.bytesused, fmt->fmt.pix.pixelformat,
+                                  fmt->fmt.pix.width, fmt->fmt.pix.height, fmt->fmt.pix.bytesperline);
+    if (xioctl(fd, VIDIOC_QBUF, &buf) == -1 || *br < 0.0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void camera_free_buffers(struct buffer *bufs, unsigned int num_bufs) {
+    for (unsigned int i = 0; i < num_bufs; i++) {
+        if (bufs[i].start) {
+            munmap(bufs[i].start, bufs[i].length);
+        }
+    }
+}
+
+/*
+ * Sum luma bytes of a row of len bytes.
+ * If packed is true, luma is found on even bytes only (YUYV).
+ */
+static uint64_t luma_sum_scalar(const uint8_t *row, size_t len, bool packed) {
+    const size_t step = packed ? 2 : 1;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < len; i += step) {
+        sum += row[i];
+    }
+    return sum;
+}
+
+#ifdef CAMERA_X86_SIMD
+
+/*
+ * psadbw against zero gives the horizontal sum of each 8 bytes;
+ * for YUYV, chroma bytes are masked out before summing.
+ */
+__attribute__((target("sse2")))
+static uint64_t luma_sum_sse2(const uint8_t *row, size_t len, bool packed) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi16(packed ? 0x00FF : 0xFFFF);
+    __m128i acc = zero;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(row + i)), mask);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return lanes[0] + lanes[1] + luma_sum_scalar(row + i, len - i, packed);
+}
+
+__attribute__((target("avx2")))
+static uint64_t luma_sum_avx2(const uint8_t *row, size_t len, bool packed) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mask = _mm256_set1_epi16(packed ? 0x00FF : 0xFFFF);
+    __m256i acc = zero;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(row + i)), mask);
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + luma_sum_scalar(row + i, len - i, packed);
+}
+
+#endif
+
+static luma_sum_fn get_luma_sum(void) {
+#ifdef CAMERA_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        DEBUG("Using AVX2 luminance kernel.\n");
+        return luma_sum_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        DEBUG("Using SSE2 luminance kernel.\n");
+        return luma_sum_sse2;
+    }
+#endif
+    return luma_sum_scalar;
+}
+
+static void *capture_thread(UNUSED void *arg) {
+    job.r = camera_capture(job.dev_name, job.num_frames, job.intensity);
+    const uint8_t done = 1;
+    if (write(job.fds[1], &done, sizeof(done)) != sizeof(done)) {
+        DEBUG("Failed to notify capture result.\n");
+    }
+    return NULL;
+}
+
+/*
+ * Store a captured frame as a camera_dump_t header followed by raw frame data,
+ * in CAMERA_DUMP_ENV directory, to be later fed to camera_bench.
+ */
+static void dump_frame(const uint8_t *data, size_t size, const struct v4l2_format *fmt) {
+    static int num_dumps;
+    char path[PATH_MAX + 1] = {0};
+    snprintf(path, PATH_MAX, "%s/frame-%d-%d.dump", getenv(CAMERA_DUMP_ENV), getpid(), num_dumps++);
+    
+    FILE *f = fopen(path, "w");
+    if (f) {
+        camera_dump_t hdr = {
+            .magic = CAMERA_DUMP_MAGIC,
+            .pixelformat = fmt->fmt.pix.pixelformat,
+            .width = fmt->fmt.pix.width,
+            .height = fmt->fmt.pix.height,
+            .stride = fmt->fmt.pix.bytesperline,
+            .size = size
+        };
+        if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 || fwrite(data, size, 1, f) != 1) {
+            DEBUG("Failed to dump frame to %s.\n", path);
+        }
+        fclose(f);
+    }
+}
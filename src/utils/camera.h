@@ -0,0 +1,24 @@
+#pragma once
+
+#include "commons.h"
+
+#define CAMERA_DUMP_MAGIC 0x4d415246     // "FRAM"
+
+enum camera_kernels { CAMERA_KERNEL_AUTO, CAMERA_KERNEL_SCALAR, CAMERA_KERNEL_SSE2, CAMERA_KERNEL_AVX2, CAMERA_KERNEL_SIZE };
+
+/* Header of frames dumped when CLIGHT_FRAME_DUMP env is set; raw frame data follows */
+typedef struct {
+    uint32_t magic;
+    uint32_t pixelformat;
+    int32_t width;
+    int32_t height;
+    int32_t stride;
+    uint32_t size;
+} camera_dump_t;
+
+int camera_capture(const char *dev_name, int num_frames, double *intensity);
+int camera_capture_start(const char *dev_name, int num_frames);
+int camera_capture_finish(double *intensity, int num_frames);
+void camera_capture_stop(void);
+int camera_set_kernel(enum camera_kernels kernel);
+double camera_frame_brightness(const uint8_t *data, size_t size, uint32_t pixelformat, int width, int height, int stride);
@@ -0,0 +1,172 @@
+#include <sys/stat.h>
+#include "ephemeris.h"
+#include "my_math.h"
+
+#define EPHEMERIS_MAGIC "CLIGHTEP"
+#define EPHEMERIS_VERSION 2
+#define EPHEMERIS_DAYS 367                  // tm_yday (0-365) + 1 as "tomorrow" can be requested on last day of leap years
+#define EPHEMERIS_PRECISION 100.0           // lat/lon are rounded to 2 decimals (~1km) to build the table key
+#define EPHEMERIS_NO_EVENT -2               // returned when there is no event (polar day/night)
+#define DAY_SECONDS 86400
+
+/*
+ * Sunrise and sunset UTC times (in seconds) for each day of a year, for a location.
+ * As they are stored as UTC times of the day, table does not depend on timezone.
+ */
+typedef struct {
+    char magic[8];
+    int32_t version;
+    int32_t lat;                            // rounded latitude * EPHEMERIS_PRECISION
+    int32_t lon;                            // rounded longitude * EPHEMERIS_PRECISION
+    int32_t year;
+    int32_t seconds[SIZE_EVENTS][EPHEMERIS_DAYS];
+} ephemeris_t;
+
+static void ephemeris_compute(const float lat, const float lon, int year, int first_yday, int num_days,
+                              int32_t (*seconds)[EPHEMERIS_DAYS]);
+static void ephemeris_load(int32_t lat, int32_t lon, int32_t year);
+static int ephemeris_load_cache(const char *cache_file, int32_t lat, int32_t lon, int32_t year);
+static void ephemeris_store_cache(const char *cache_file);
+static void init_cache_file(char *filename);
+
+static ephemeris_t table;
+
+/*
+ * O(1) lookup of event time for given day of the year.
+ * Table is (re)loaded only when location or year change.
+ */
+int ephemeris_get(const float lat, const float lon, enum day_events event, int year, int yday, int *seconds) {
+    const int32_t key_lat = lround(lat * EPHEMERIS_PRECISION);
+    const int32_t key_lon = lround(lon * EPHEMERIS_PRECISION);
+    
+    int32_t s;
+    if (yday < 0 || yday >= EPHEMERIS_DAYS) {
+        /* Out of table (eg: yesterday on January 1st); just compute it */
+        int32_t day[SIZE_EVENTS][EPHEMERIS_DAYS];
+        ephemeris_compute(lat, lon, year, yday, 1, day);
+        s = day[event][0];
+    } else {
+        if (memcmp(table.magic, EPHEMERIS_MAGIC, sizeof(table.magic)) ||
+            table.lat != key_lat || table.lon != key_lon || table.year != year) {
+            
+            ephemeris_load(key_lat, key_lon, year);
+        }
+        s = table.seconds[event][yday];
+    }
+    
+    if (s == EPHEMERIS_NO_EVENT) {
+        return EPHEMERIS_NO_EVENT;
+    }
+    *seconds = s;
+    return 0;
+}
+
+/*
+ * Fill seconds[event][0..num_days) with events times starting from first_yday,
+ * normalized to [0, DAY_SECONDS), through a single batch computation.
+ */
+static void ephemeris_compute(const float lat, const float lon, int year, int first_yday, int num_days,
+                              int32_t (*seconds)[EPHEMERIS_DAYS]) {
+    double events[SIZE_EVENTS][EPHEMERIS_DAYS];
+    calculate_sun_events(lat, lon, year, first_yday, num_days, events[SUNRISE], events[SUNSET]);
+    
+    for (int ev = SUNRISE; ev < SIZE_EVENTS; ev++) {
+        for (int day = 0; day < num_days; day++) {
+            if (isnan(events[ev][day])) {
+                seconds[ev][day] = EPHEMERIS_NO_EVENT;
+            } else {
+                const int32_t t = lround(events[ev][day]) % DAY_SECONDS;
+                seconds[ev][day] = t < 0 ? t + DAY_SECONDS : t;
+            }
+        }
+    }
+}
+
+/*
+ * Load table from cache file if it was built for same location,
+ * otherwise compute it and store it in cache.
+ */
+static void ephemeris_load(int32_t lat, int32_t lon, int32_t year) {
+    char cache_file[PATH_MAX + 1] = {0};
+    init_cache_file(cache_file);
+    
+    if (ephemeris_load_cache(cache_file, lat, lon, year) == 0) {
+        DEBUG("Ephemeris table loaded from cache.\n");
+        return;
+    }
+    
+    const float r_lat = lat / EPHEMERIS_PRECISION;
+    const float r_lon = lon / EPHEMERIS_PRECISION;
+    ephemeris_compute(r_lat, r_lon, year, 0, EPHEMERIS_DAYS, table.seconds);
+    memcpy(table.magic, EPHEMERIS_MAGIC, sizeof(table.magic));
+    table.version = EPHEMERIS_VERSION;
+    table.lat = lat;
+    table.lon = lon;
+    table.year = year;
+    DEBUG("Ephemeris table computed for %.2lf %.2lf (%d).\n", r_lat, r_lon, year);
+    
+    ephemeris_store_cache(cache_file);
+}
+
+static int ephemeris_load_cache(const char *cache_file, int32_t lat, int32_t lon, int32_t year) {
+    int ret = -1;
+    FILE *f = fopen(cache_file, "r");
+    if (f) {
+        ephemeris_t tmp;
+        if (fread(&tmp, sizeof(tmp), 1, f) == 1 &&
+            !memcmp(tmp.magic, EPHEMERIS_MAGIC, sizeof(tmp.magic)) &&
+            tmp.version == EPHEMERIS_VERSION && tmp.lat == lat && tmp.lon == lon && tmp.year == year) {
+            
+            memcpy(&table, &tmp, sizeof(table));
+            ret = 0;
+        }
+        fclose(f);
+    }
+    return ret;
+}
+
+/*
+ * Write table to a temp file, then rename it over cache_file,
+ * so that a crash never leaves a truncated cache behind.
+ */
+static void ephemeris_store_cache(const char *cache_file) {
+    char tmp_file[PATH_MAX + 1] = {0};
+    snprintf(tmp_file, PATH_MAX, "%s.tmp", cache_file);
+
+    /* Create cache folder if it does not exist, eg: on a fresh account */
+    char dir[PATH_MAX + 1] = {0};
+    strncpy(dir, cache_file, PATH_MAX);
+    char *sep = strrchr(dir, '/');
+    if (sep) {
+        *sep = '\0';
+        mkdir(dir, 0700);
+    }
+
+    FILE *f = fopen(tmp_file, "w");
+    if (f) {
+        int r = -1;
+        if (fwrite(&table, sizeof(table), 1, f) == 1 && fflush(f) == 0 && fsync(fileno(f)) == 0) {
+            r = 0;
+        }
+        if (fclose(f) != 0) {
+            r = -1;
+        }
+        if (r == 0) {
+            r = rename(tmp_file, cache_file);
+        }
+        if (r != 0) {
+            WARN("Caching ephemeris failed: %s.\n", strerror(errno));
+            unlink(tmp_file);
+        }
+    } else {
+        WARN("Caching ephemeris failed: %s.\n", strerror(errno));
+    }
+}
+
+static void init_cache_file(char *filename) {
+    if (getenv("XDG_CACHE_HOME")) {
+        snprintf(filename, PATH_MAX, "%s/clight-ephemeris", getenv("XDG_CACHE_HOME"));
+    } else {
+        snprintf(filename, PATH_MAX, "%s/.cache/clight-ephemeris", getpwuid(getuid())->pw_dir);
+    }
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "commons.h"
+
+int ephemeris_get(const float lat, const float lon, enum day_events event, int year, int yday, int *seconds);
@@ -55,6 +55,7 @@ void log_conf(void) {
         fprintf(log_file, "* Captures:\t\t%d\n", conf.num_captures);
         fprintf(log_file, "* Sensor device:\t\t%s\n", strlen(conf.dev_name) ? conf.dev_name : "Unset");
         fprintf(log_file, "* Sensor settings:\t\t%s\n", strlen(conf.dev_opts) ? conf.dev_opts : "Unset");
+        fprintf(log_file, "* Native capture:\t\t%s\n", conf.native_capture ? "Enabled" : "Disabled");
         fprintf(log_file, "* Backlight path:\t\t%s\n", strlen(conf.screen_path) ? conf.screen_path : "Unset");
         fprintf(log_file, "* Keyboard backlight:\t\t%s\n", conf.no_keyboard_bl ? "Disabled" : "Enabled");
         fprintf(log_file, "* Shutter threshold:\t\t%.2lf\n", conf.shutter_threshold);
@@ -77,6 +78,7 @@ void log_conf(void) {
         fprintf(log_file, "* User set sunset:\t\t%s\n", strlen(conf.day_events[SUNSET]) ? conf.day_events[SUNSET] : "Unset");
         fprintf(log_file, "* Event duration:\t\t%d\n", conf.event_duration);
         fprintf(log_file, "* Long transition:\t\t%s\n", conf.gamma_long_transition ? "Enabled" : "Disabled");
+        fprintf(log_file, "* Long transition curve:\t\t%s\n", conf.gamma_trans_curve == SIGMOID_CURVE ? "Sigmoid" : "Linear");
         fprintf(log_file, "* Ambient gamma:\t\t%s\n", conf.ambient_gamma ? "Enabled" : "Disabled");
         
         fprintf(log_file, "\n### DIMMER ###\n");
@@ -92,6 +94,7 @@ void log_conf(void) {
         fprintf(log_file, "\n### DPMS ###\n");
         fprintf(log_file, "* Enabled:\t\t%s\n", conf.no_dpms ? "false" : "true");
         fprintf(log_file, "* Timeouts:\t\tAC %d\tBATT %d\n", conf.dpms_timeout[ON_AC], conf.dpms_timeout[ON_BATTERY]);
+        fprintf(log_file, "* Simulate activity window:\t\t%d\n", conf.simulate_window);
         
         fprintf(log_file, "\n### SCREEN ###\n");
         fprintf(log_file, "* Enabled:\t\t%s\n", conf.no_screen ? "false" : "true");
@@ -99,6 +102,19 @@ void log_conf(void) {
         fprintf(log_file, "* Contrib:\t\t%.2lf\n", conf.screen_contrib);
         fprintf(log_file, "* Samples:\t\t%d\n", conf.screen_samples);
         
+        fprintf(log_file, "\n### HISTORY ###\n");
+        fprintf(log_file, "* Enabled:\t\t%s\n", conf.history_size > 0 ? "true" : "false");
+        fprintf(log_file, "* Size:\t\t%d\n", conf.history_size);
+        
+        fprintf(log_file, "\n### CONTROL SOCKET ###\n");
+        fprintf(log_file, "* Enabled:\t\t%s\n", conf.control_socket ? "true" : "false");
+        
+        fprintf(log_file, "\n### RATE LIMITS (calls/min) ###\n");
+        fprintf(log_file, "* Calibrate:\t\t%d\n", conf.rate_limit[RATE_CALIBRATE]);
+        fprintf(log_file, "* Inhibit:\t\t%d\n", conf.rate_limit[RATE_INHIBIT]);
+        fprintf(log_file, "* Load/Unload:\t\t%d\n", conf.rate_limit[RATE_LOAD]);
+        fprintf(log_file, "* Conf:\t\t%d\n", conf.rate_limit[RATE_CONF]);
+        
         fprintf(log_file, "\n### GENERIC ###\n");
         fprintf(log_file, "* Verbose (debugging):\t\t%s\n\n", conf.verbose ? "Enabled" : "Disabled");
         
@@ -1,10 +1,12 @@
 #include <gsl/gsl_multifit.h>
-#include <gsl/gsl_statistics_double.h>
 #include "my_math.h"
+#include "ephemeris.h"
 
-#define ZENITH -0.83
+#define ZENITH 90.833                      // sun zenith at sunrise/sunset, accounting for atmospheric refraction and sun radius
 
-static float to_hours(const float rad);
+static void solar_position(const double jd, double *sin_decl, double *eq_time);
+static double hour_angle(const double sin_decl, const double sin_lat, const double cos_lat, const double cos_zenith);
+static double interpolate(const double *v, const double t);
 static int calculate_sunrise_sunset(const float lat, const float lng, time_t *tt, enum day_events event, int tomorrow);
 
 /*
@@ -21,14 +23,6 @@ double radToDeg(double angleRad) {
     return (180.0 * angleRad / M_PI);
 }
 
-/*
- * Compute mean and normalize between 0-1
- */
-double compute_average(double *intensity, int num) {
-    double mean = gsl_stats_mean(intensity, 1, num);
-    return mean;
-}
-
 /*
  * Big thanks to https://rosettacode.org/wiki/Polynomial_regression#C
  */
@@ -75,17 +69,16 @@ double clamp(double value, double max, double min) {
     return value;
 }
 
-static float to_hours(const float rad) {
-    return rad / 15.0;// 360 degree / 24 hours = 15 degrees/h
-}
-
 /*
  * Just a small function to compute sunset/sunrise for today (or tomorrow).
- * See: http://stackoverflow.com/questions/7064531/sunrise-sunset-times-in-c
  * If conf.events[event] is set, it means "event" time is user-set.
  * So, only store in *tt its corresponding time_t values.
+ * Otherwise, event time is read from the yearly ephemeris table.
  */
 static int calculate_sunrise_sunset(const float lat, const float lng, time_t *tt, enum day_events event, int tomorrow) {
+    static char fixed_event[SIZE_EVENTS][sizeof(conf.day_events[0])];
+    static struct tm fixed_tm[SIZE_EVENTS];
+    
     // 1. compute the day of the year (timeinfo->tm_yday below)
     time(tt);
     struct tm *timeinfo = localtime(tt);
@@ -97,70 +90,28 @@ static int calculate_sunrise_sunset(const float lat, const float lng, time_t *tt
     timeinfo->tm_mday += tomorrow;
     timeinfo->tm_sec = 0;
 
-    /* If user provided a sunrise/sunset time, use them */
+    /* If user provided a sunrise/sunset time, use them; only parse them when they change */
     if (strlen(conf.day_events[event]) > 0) {
-        strptime(conf.day_events[event], "%R", timeinfo);
+        if (strcmp(fixed_event[event], conf.day_events[event])) {
+            strptime(conf.day_events[event], "%R", &fixed_tm[event]);
+            strncpy(fixed_event[event], conf.day_events[event], sizeof(fixed_event[event]));
+        }
+        timeinfo->tm_hour = fixed_tm[event].tm_hour;
+        timeinfo->tm_min = fixed_tm[event].tm_min;
         *tt = mktime(timeinfo);
         return 0;
     }
 
-    // 2. convert the longitude to hour value and calculate an approximate time
-    float lngHour = to_hours(lng);
-    float t;
-    if (event == SUNRISE) {
-        t = timeinfo->tm_yday + (6.0 - lngHour) / 24.0;
-    } else {
-        t = timeinfo->tm_yday + (18.0 - lngHour) / 24.0;
+    int seconds;
+    int r = ephemeris_get(lat, lng, event, timeinfo->tm_year + 1900, timeinfo->tm_yday, &seconds);
+    if (r != 0) {
+        return r;
     }
 
-    // 3. calculate the Sun's mean anomaly
-    float M = (0.9856 * t) - 3.289;
-
-    // 4. calculate the Sun's true longitude
-    float L = fmod(M + 1.916 * sin(degToRad(M)) + 0.020 * sin(2 * degToRad(M)) + 282.634, 360.0);
-
-    // 5a. calculate the Sun's right ascension
-    float RA = fmod(radToDeg(atan(0.91764 * tan(degToRad(L)))), 360.0);
-
-    // 5b. right ascension value needs to be in the same quadrant as L
-    float Lquadrant = floor(L / 90) * 90;
-    float RAquadrant = floor(RA / 90) * 90;
-    RA += (Lquadrant - RAquadrant);
-
-    // 5c. right ascension value needs to be converted into hours
-    RA = to_hours(RA);
-
-    // 6. calculate the Sun's declination
-    float sinDec = 0.39782 * sin(degToRad(L));
-    float cosDec = cos(asin(sinDec));
-
-    // 7a. calculate the Sun's local hour angle
-    float cosH = sin(degToRad(ZENITH)) - (sinDec * sin(degToRad(lat))) / (cosDec * cos(degToRad(lat)));
-    if ((cosH > 1 && event == SUNRISE) || (cosH < -1 && event == SUNSET)) {
-        return -2; // no sunrise/sunset today!
-    }
-
-    // 7b. finish calculating H and convert into hours
-    float H;
-    if (event == SUNRISE) {
-        H = 360.0 - radToDeg(acos(cosH));
-    } else {
-        H = radToDeg(acos(cosH));
-    }
-    H = to_hours(H);
-
-    // 8. calculate local mean time of rising/setting
-    float T = H + RA - (0.06571 * t) - 6.622;
-
-    // 9. adjust back to UTC
-    float UT = fmod(24 + fmod(T - lngHour, 24.0), 24.0);
-
-    double hours;
-    double minutes = modf(UT, &hours) * 60;
-
     // set correct values
-    timeinfo->tm_hour = hours;
-    timeinfo->tm_min = minutes;
+    timeinfo->tm_hour = seconds / 3600;
+    timeinfo->tm_min = (seconds / 60) % 60;
+    timeinfo->tm_sec = seconds % 60;
 
     // store in user provided ptr correct data
     *tt = timegm(timeinfo);
@@ -170,6 +121,109 @@ static int calculate_sunrise_sunset(const float lat, const float lng, time_t *tt
     return 0;
 }
 
+/*
+ * Double precision NOAA solar position algorithm.
+ * See: https://gml.noaa.gov/grad/solcalc/calcdetails.html
+ * Computes sunrise and sunset UTC times (in seconds from UTC midnight of each day;
+ * they can fall outside [0, 86400) for far east/west longitudes)
+ * for num_days consecutive days starting from first_yday day of given year.
+ * Days without a sunrise/sunset (polar day/night) are set to NAN.
+ *
+ * Solar position is computed once per day, at approximate local noon;
+ * each event is then refined at its estimated time by interpolating
+ * the position between previous, current and next day noons.
+ * See tests/sun_events_test.c for accuracy against a fully converged solution
+ * and tests/sun_events_bench.c for comparison against the old per-event algorithm.
+ */
+void calculate_sun_events(const double lat, const double lon, const int year, const int first_yday,
+                          const int num_days, double *sunrise, double *sunset) {
+    /* Julian day of January 1st, 0:00 UTC of given year */
+    struct tm jan1 = { .tm_year = year - 1900, .tm_mday = 1 };
+    const double jd_year = timegm(&jan1) / 86400.0 + 2440587.5;
+    const double noon_offset = 0.5 - lon / 360.0;   // approximate local noon, in days from UTC midnight
+    
+    const double latr = degToRad(lat);
+    const double sin_lat = sin(latr);
+    const double cos_lat = cos(latr);
+    const double cos_zenith = cos(degToRad(ZENITH));
+    
+    /* Solar position at approximate local noon of each day, plus the day before and the day after */
+    double sin_decl[num_days + 2], eq_time[num_days + 2];
+    for (int i = 0; i < num_days + 2; i++) {
+        solar_position(jd_year + first_yday + i - 1 + noon_offset, &sin_decl[i], &eq_time[i]);
+    }
+    
+    for (int i = 0; i < num_days; i++) {
+        const double *sd = &sin_decl[i + 1];
+        const double *eq = &eq_time[i + 1];
+        
+        /* First pass at approximate solar noon */
+        const double ha = hour_angle(sd[0], sin_lat, cos_lat, cos_zenith);
+        const double noon = 720 - 4 * lon - eq[0];
+        
+        /* Second pass at estimated events time (in days from approximate local noon) */
+        const double t_rise = (noon - 4 * ha) / 1440.0 - noon_offset;
+        const double t_set = (noon + 4 * ha) / 1440.0 - noon_offset;
+        const double ha_rise = hour_angle(interpolate(sd, t_rise), sin_lat, cos_lat, cos_zenith);
+        const double ha_set = hour_angle(interpolate(sd, t_set), sin_lat, cos_lat, cos_zenith);
+        
+        sunrise[i] = (720 - 4 * lon - interpolate(eq, t_rise) - 4 * ha_rise) * 60;
+        sunset[i] = (720 - 4 * lon - interpolate(eq, t_set) + 4 * ha_set) * 60;
+    }
+}
+
+/*
+ * Compute sine of sun declination and equation of time (minutes) at jd julian day.
+ */
+static void solar_position(const double jd, double *sin_decl, double *eq_time) {
+    const double T = (jd - 2451545.0) / 36525.0;   // julian century
+    
+    const double L0 = fmod(280.46646 + T * (36000.76983 + T * 0.0003032), 360.0);   // geometric mean longitude (deg)
+    const double M = 357.52911 + T * (35999.05029 - 0.0001537 * T);                 // geometric mean anomaly (deg)
+    const double e = 0.016708634 - T * (0.000042037 + 0.0000001267 * T);            // earth orbit eccentricity
+    
+    const double Mr = degToRad(M);
+    const double sin_M = sin(Mr);
+    const double cos_M = cos(Mr);
+    const double sin_2M = 2 * sin_M * cos_M;
+    const double C = sin_M * (1.914602 - T * (0.004817 + 0.000014 * T)) +
+                     sin_2M * (0.019993 - 0.000101 * T) +
+                     sin_M * (3 - 4 * sin_M * sin_M) * 0.000289;                    // equation of center (deg)
+    
+    const double omega = degToRad(125.04 - 1934.136 * T);
+    const double app_long = degToRad(L0 + C - 0.00569 - 0.00478 * sin(omega));     // apparent longitude
+    
+    const double eps0 = 23.0 + (26.0 + (21.448 - T * (46.815 + T * (0.00059 - T * 0.001813))) / 60.0) / 60.0;
+    const double eps = degToRad(eps0 + 0.00256 * cos(omega));                       // corrected obliquity
+    const double cos_eps = cos(eps);
+    
+    *sin_decl = sin(eps) * sin(app_long);
+    
+    const double y = (1 - cos_eps) / (1 + cos_eps);                                 // tan(eps / 2)^2
+    const double L0r = degToRad(2 * L0);
+    const double sin_2L0 = sin(L0r);
+    const double cos_2L0 = cos(L0r);
+    *eq_time = 4 * radToDeg(y * sin_2L0 - 2 * e * sin_M + 4 * e * y * sin_M * cos_2L0 -
+                            y * y * sin_2L0 * cos_2L0 - 1.25 * e * e * sin_2M);    // minutes
+}
+
+/*
+ * Sunrise hour angle (degrees) for given sun declination sine;
+ * NAN when sun never reaches ZENITH (polar day/night), as acos() is out of domain.
+ */
+static inline double hour_angle(const double sin_decl, const double sin_lat, const double cos_lat, const double cos_zenith) {
+    const double cos_decl = sqrt(1 - sin_decl * sin_decl);
+    return radToDeg(acos((cos_zenith - sin_lat * sin_decl) / (cos_lat * cos_decl)));
+}
+
+/*
+ * Quadratic interpolation at t days from v[0],
+ * given values at previous (v[-1]) and next (v[1]) day.
+ */
+static inline double interpolate(const double *v, const double t) {
+    return v[0] + t * (v[1] - v[-1]) / 2 + t * t * (v[1] - 2 * v[0] + v[-1]) / 2;
+}
+
 int calculate_sunrise(const float lat, const float lng, time_t *tt, int tomorrow) {
     return calculate_sunrise_sunset(lat, lng, tt, SUNRISE, tomorrow);
 }
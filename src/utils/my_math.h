@@ -4,8 +4,9 @@
 
 double degToRad(double angleDeg);
 double radToDeg(double angleRad);
-double compute_average(double *intensity, int num);
 void polynomialfit(enum ac_states s);
 double clamp(double value, double max, double min);
 int calculate_sunrise(const float lat, const float lng, time_t *tt, int tomorrow) ;
 int calculate_sunset(const float lat, const float lng, time_t *tt, int tomorrow);
+void calculate_sun_events(const double lat, const double lon, const int year, const int first_yday,
+                          const int num_days, double *sunrise, double *sunset);
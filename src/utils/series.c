@@ -0,0 +1,164 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "series.h"
+
+#define SERIES_MAGIC "CLIGHTTS"
+#define SERIES_VERSION 1
+#define SERIES_CLOCK_SKEW 60                // seconds the clock may go back before the series is reset
+
+/*
+ * On-disk layout: a header followed by a fixed-size ring of records.
+ * Records are appended in time order; when the ring is full,
+ * oldest records get overwritten.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t rec_size;
+    uint64_t capacity;                      // number of records in the ring
+    uint64_t head;                          // index of next record to be written
+    uint64_t count;                         // number of valid records
+} series_hdr_t;
+
+typedef struct {
+    uint64_t time;                          // seconds since epoch
+    int32_t type;                           // mod_msg_types topic this record belongs to
+    uint32_t reserved;
+    double value;
+} series_rec_t;
+
+static uint64_t series_idx(uint64_t i);
+static uint64_t series_lower_bound(uint64_t since);
+
+static series_hdr_t *hdr;
+static series_rec_t *recs;
+static size_t map_size;
+
+/*
+ * Open (or create) the time-series file at path, able to hold capacity records.
+ * If an existing file has a different layout or capacity, it is reset.
+ */
+int series_open(const char *path, uint64_t capacity) {
+    if (capacity == 0) {
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        WARN("Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    map_size = sizeof(series_hdr_t) + capacity * sizeof(series_rec_t);
+    bool reset = fstat(fd, &st) == -1 || (size_t)st.st_size != map_size;
+    if (reset && (ftruncate(fd, 0) == -1 || ftruncate(fd, map_size) == -1)) {
+        WARN("Failed to resize %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    hdr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        WARN("Failed to map %s: %s\n", path, strerror(errno));
+        hdr = NULL;
+        return -1;
+    }
+    recs = (series_rec_t *)(hdr + 1);
+
+    if (reset || memcmp(hdr->magic, SERIES_MAGIC, sizeof(hdr->magic)) ||
+        hdr->version != SERIES_VERSION || hdr->rec_size != sizeof(series_rec_t) ||
+        hdr->capacity != capacity || hdr->head >= capacity || hdr->count > capacity) {
+
+        DEBUG("Initializing new time-series file %s.\n", path);
+        memset(hdr, 0, sizeof(series_hdr_t));
+        memcpy(hdr->magic, SERIES_MAGIC, sizeof(hdr->magic));
+        hdr->version = SERIES_VERSION;
+        hdr->rec_size = sizeof(series_rec_t);
+        hdr->capacity = capacity;
+    }
+    return 0;
+}
+
+/*
+ * O(1) append of a new record, overwriting the oldest one when full.
+ * Records must stay sorted for series_range() binary search:
+ * small clock jitters are clamped to last record time, while
+ * if the clock went back further (eg: a wrong RTC time got corrected),
+ * old records are dropped, as they would be stamped in the future.
+ */
+void series_append(enum mod_msg_types type, uint64_t time, double value) {
+    if (hdr) {
+        if (hdr->count > 0) {
+            const uint64_t last = recs[series_idx(hdr->count - 1)].time;
+            if (last > time + SERIES_CLOCK_SKEW) {
+                INFO("Clock went back by %llus. Resetting time-series.\n", (unsigned long long)(last - time));
+                hdr->head = 0;
+                hdr->count = 0;
+            } else if (last > time) {
+                time = last;
+            }
+        }
+        series_rec_t *r = &recs[hdr->head];
+        r->time = time;
+        r->type = type;
+        r->value = value;
+        hdr->head = (hdr->head + 1) % hdr->capacity;
+        if (hdr->count < hdr->capacity) {
+            hdr->count++;
+        }
+    }
+}
+
+/*
+ * Call cb for each record of given type whose time is between since and until (included).
+ * Start record is found through a binary search, as records are time-ordered.
+ */
+int series_range(enum mod_msg_types type, uint64_t since, uint64_t until, series_cb cb, void *userdata) {
+    if (!hdr) {
+        return -1;
+    }
+
+    for (uint64_t i = series_lower_bound(since); i < hdr->count; i++) {
+        const series_rec_t *r = &recs[series_idx(i)];
+        if (r->time > until) {
+            break;
+        }
+        if (r->type == type) {
+            int ret = cb(r->time, r->value, userdata);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+void series_close(void) {
+    if (hdr) {
+        munmap(hdr, map_size);
+        hdr = NULL;
+        recs = NULL;
+    }
+}
+
+/* Map a logical index (0 -> oldest record) to its ring position */
+static inline uint64_t series_idx(uint64_t i) {
+    return (hdr->head + hdr->capacity - hdr->count + i) % hdr->capacity;
+}
+
+/* Logical index of first record with time >= since */
+static uint64_t series_lower_bound(uint64_t since) {
+    uint64_t lo = 0, hi = hdr->count;
+    while (lo < hi) {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        if (recs[series_idx(mid)].time < since) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "commons.h"
+
+typedef int (*series_cb)(uint64_t time, double value, void *userdata);
+
+int series_open(const char *path, uint64_t capacity);
+void series_append(enum mod_msg_types type, uint64_t time, double value);
+int series_range(enum mod_msg_types type, uint64_t since, uint64_t until, series_cb cb, void *userdata);
+void series_close(void);
@@ -0,0 +1,147 @@
+#include "stats.h"
+
+static int sorted_lower_bound(const stats_t *s, int n, double value);
+static void sorted_remove(stats_t *s, double value);
+static void sorted_insert(stats_t *s, double value);
+
+/*
+ * Init s to hold a window of capacity samples.
+ * alpha is the EWMA smoothing factor (between 0 and 1);
+ * if median is true, a sorted copy of the window is kept too.
+ */
+int stats_init(stats_t *s, int capacity, double alpha, bool median) {
+    memset(s, 0, sizeof(stats_t));
+    if (capacity <= 0) {
+        return -1;
+    }
+    
+    s->samples = calloc(capacity, sizeof(double));
+    if (median) {
+        s->sorted = calloc(capacity, sizeof(double));
+    }
+    if (!s->samples || (median && !s->sorted)) {
+        stats_free(s);
+        return -1;
+    }
+    s->capacity = capacity;
+    s->alpha = alpha;
+    return 0;
+}
+
+void stats_free(stats_t *s) {
+    free(s->samples);
+    free(s->sorted);
+    s->samples = NULL;
+    s->sorted = NULL;
+    s->capacity = 0;
+    stats_reset(s);
+}
+
+void stats_reset(stats_t *s) {
+    s->count = 0;
+    s->head = 0;
+    s->mean = 0.0;
+    s->m2 = 0.0;
+    s->ewma = 0.0;
+}
+
+/*
+ * O(1) update of mean and variance through Welford's algorithm;
+ * when window is full, oldest sample is removed from them in the same step.
+ * Median update costs a binary search plus a memmove of the sorted window.
+ */
+void stats_push(stats_t *s, double value) {
+    if (s->capacity == 0) {
+        return;
+    }
+    
+    if (s->count < s->capacity) {
+        s->count++;
+        const double delta = value - s->mean;
+        s->mean += delta / s->count;
+        s->m2 += delta * (value - s->mean);
+        s->ewma = s->count == 1 ? value : s->ewma + s->alpha * (value - s->ewma);
+    } else {
+        const double old = s->samples[s->head];
+        const double old_mean = s->mean;
+        s->mean += (value - old) / s->count;
+        s->m2 += (value - old) * (value - s->mean + old - old_mean);
+        if (s->m2 < 0.0) {
+            /* Avoid rounding errors making variance negative */
+            s->m2 = 0.0;
+        }
+        s->ewma += s->alpha * (value - s->ewma);
+        if (s->sorted) {
+            sorted_remove(s, old);
+        }
+    }
+    
+    if (s->sorted) {
+        sorted_insert(s, value);
+    }
+    s->samples[s->head] = value;
+    s->head = (s->head + 1) % s->capacity;
+}
+
+bool stats_full(const stats_t *s) {
+    return s->capacity > 0 && s->count == s->capacity;
+}
+
+double stats_mean(const stats_t *s) {
+    return s->mean;
+}
+
+double stats_sum(const stats_t *s) {
+    return s->mean * s->count;
+}
+
+/* Sample variance of current window */
+double stats_variance(const stats_t *s) {
+    if (s->count < 2) {
+        return 0.0;
+    }
+    return s->m2 / (s->count - 1);
+}
+
+double stats_ewma(const stats_t *s) {
+    return s->ewma;
+}
+
+/* Returns NAN if median was not enabled on stats_init() */
+double stats_median(const stats_t *s) {
+    if (!s->sorted || s->count == 0) {
+        return NAN;
+    }
+    if (s->count % 2) {
+        return s->sorted[s->count / 2];
+    }
+    return (s->sorted[s->count / 2 - 1] + s->sorted[s->count / 2]) / 2;
+}
+
+/* Index of first sorted sample >= value, among first n sorted ones */
+static int sorted_lower_bound(const stats_t *s, int n, double value) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        const int mid = lo + (hi - lo) / 2;
+        if (s->sorted[mid] < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Called with s->count still accounting for value */
+static void sorted_remove(stats_t *s, double value) {
+    const int idx = sorted_lower_bound(s, s->count, value);
+    memmove(&s->sorted[idx], &s->sorted[idx + 1], (s->count - idx - 1) * sizeof(double));
+}
+
+/* Called with s->count already accounting for value */
+static void sorted_insert(stats_t *s, double value) {
+    const int n = s->count - 1; // number of samples already sorted
+    const int lo = sorted_lower_bound(s, n, value);
+    memmove(&s->sorted[lo + 1], &s->sorted[lo], (n - lo) * sizeof(double));
+    s->sorted[lo] = value;
+}
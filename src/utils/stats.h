@@ -0,0 +1,30 @@
+#pragma once
+
+#include "commons.h"
+
+/*
+ * Fixed-capacity sliding window of samples,
+ * keeping its statistics updated on each new sample.
+ */
+typedef struct {
+    double *samples;                        // ring of last capacity samples
+    double *sorted;                         // samples kept sorted, for median (NULL if disabled)
+    int capacity;
+    int count;                              // number of valid samples
+    int head;                               // index of next sample to be written
+    double mean;
+    double m2;                              // sum of squared differences from mean (Welford)
+    double ewma;
+    double alpha;                           // EWMA smoothing factor
+} stats_t;
+
+int stats_init(stats_t *s, int capacity, double alpha, bool median);
+void stats_free(stats_t *s);
+void stats_reset(stats_t *s);
+void stats_push(stats_t *s, double value);
+bool stats_full(const stats_t *s);
+double stats_mean(const stats_t *s);
+double stats_sum(const stats_t *s);
+double stats_variance(const stats_t *s);
+double stats_ewma(const stats_t *s);
+double stats_median(const stats_t *s);
@@ -42,6 +42,29 @@ void set_timeout(int sec, int nsec, int fd, int flag) {
     }
 }
 
+/*
+ * Arm timerfd (created on CLOCK_REALTIME) to fire at absolute time t.
+ * If wall clock is changed meanwhile, reading the timer fails with ECANCELED.
+ * Times in the past are refused, as timer would fire straight away.
+ * Returns -1 on failure, leaving timer untouched: callers decide how to fall back.
+ */
+int set_abs_timeout(time_t t, int fd) {
+    struct itimerspec timerValue = {{0}};
+    
+    if (t <= time(NULL)) {
+        DEBUG("Refusing past absolute timeout on fd %d.\n", fd);
+        return -1;
+    }
+    timerValue.it_value.tv_sec = t;
+    int r = timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &timerValue, NULL);
+    if (r == -1) {
+        WARN("Failed to set absolute timeout on fd %d: %s\n", fd, strerror(errno));
+        return -1;
+    }
+    DEBUG("Set absolute timeout on fd %d.\n", fd);
+    return 0;
+}
+
 static long get_timeout_sec(int fd) {
     return get_timeout(fd, offsetof(struct timespec, tv_sec));
 }
@@ -71,7 +94,14 @@ void reset_timer(int fd, int old_timer, int new_timer) {
     }
 }
 
-void read_timer(int fd) {
+/*
+ * Returns -1 (with errno set) on failure,
+ * eg: ECANCELED when wall clock changed for TFD_TIMER_CANCEL_ON_SET timers.
+ */
+int read_timer(int fd) {
     uint64_t t;
-    read(fd, &t, sizeof(uint64_t));
+    if (read(fd, &t, sizeof(uint64_t)) == -1) {
+        return -1;
+    }
+    return 0;
 }
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <linux/videodev2.h>
+#include "camera.h"
+
+/*
+ * Check every luminance kernel supported by current CPU against the scalar one,
+ * then time them, on frames recorded with CLIGHT_FRAME_DUMP env set
+ * (eg: CLIGHT_FRAME_DUMP=/tmp/frames clight --native-capture) or,
+ * if none is given, on generated frames of awkward sizes and strides.
+ * Returns 1 if any kernel disagrees with the scalar one.
+ */
+
+typedef struct {
+    camera_dump_t hdr;
+    uint8_t *data;
+    char name[64];
+} frame_t;
+
+static const char *kernel_names[CAMERA_KERNEL_SIZE] = { "auto", "scalar", "sse2", "avx2" };
+
+static int load_dump(const char *path, frame_t *f) {
+    int ret = -1;
+    FILE *in = fopen(path, "r");
+    if (in) {
+        if (fread(&f->hdr, sizeof(f->hdr), 1, in) == 1 && f->hdr.magic == CAMERA_DUMP_MAGIC) {
+            f->data = malloc(f->hdr.size);
+            if (f->data && fread(f->data, f->hdr.size, 1, in) == 1) {
+                snprintf(f->name, sizeof(f->name), "%.63s", strrchr(path, '/') ? strrchr(path, '/') + 1 : path);
+                ret = 0;
+            } else {
+                free(f->data);
+            }
+        }
+        fclose(in);
+    }
+    if (ret) {
+        fprintf(stderr, "%s is not a valid frame dump.\n", path);
+    }
+    return ret;
+}
+
+static void gen_frame(frame_t *f, uint32_t fmt, int width, int height, int padding) {
+    const int row_len = fmt == V4L2_PIX_FMT_YUYV ? 2 * width : width;
+    f->hdr = (camera_dump_t) {
+        .magic = CAMERA_DUMP_MAGIC,
+        .pixelformat = fmt,
+        .width = width,
+        .height = height,
+        .stride = row_len + padding,
+        .size = (row_len + padding) * height
+    };
+    f->data = malloc(f->hdr.size);
+    for (uint32_t i = 0; i < f->hdr.size; i++) {
+        f->data[i] = rand() & 0xFF;
+    }
+    snprintf(f->name, sizeof(f->name), "%s %dx%d+%d", fmt == V4L2_PIX_FMT_YUYV ? "YUYV" : "GREY", width, height, padding);
+}
+
+static double frame_brightness(const frame_t *f) {
+    return camera_frame_brightness(f->data, f->hdr.size, f->hdr.pixelformat, f->hdr.width, f->hdr.height, f->hdr.stride);
+}
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = 1000;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:")) != -1) {
+        if (opt == 'i') {
+            iterations = atoi(optarg);
+        } else {
+            fprintf(stderr, "Usage: %s [-i iterations] [frame.dump...]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    int num_frames = 0;
+    frame_t *frames;
+    if (optind < argc) {
+        frames = calloc(argc - optind, sizeof(frame_t));
+        for (int i = optind; i < argc; i++) {
+            if (load_dump(argv[i], &frames[num_frames]) == 0) {
+                num_frames++;
+            }
+        }
+    } else {
+        const int widths[] = { 1, 7, 15, 16, 17, 31, 33, 320, 641, 1280 };
+        const int heights[] = { 1, 3, 480 };
+        const int paddings[] = { 0, 13, 64 };
+        const uint32_t fmts[] = { V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_YUYV };
+        frames = calloc(2 * 10 * 3 * 3, sizeof(frame_t));
+        srand(42);
+        for (int f = 0; f < 2; f++) {
+            for (int w = 0; w < 10; w++) {
+                for (int h = 0; h < 3; h++) {
+                    for (int p = 0; p < 3; p++) {
+                        gen_frame(&frames[num_frames++], fmts[f], widths[w], heights[h], paddings[p]);
+                    }
+                }
+            }
+        }
+    }
+
+    int failed = 0;
+
+    /* Stride must be validated before being compared against row length */
+    const uint8_t px[4] = {0};
+    if (camera_frame_brightness(px, sizeof(px), V4L2_PIX_FMT_GREY, 2, 2, -1) != -1.0) {
+        fprintf(stderr, "Negative stride was not rejected.\n");
+        failed = 1;
+    }
+
+    double ns[CAMERA_KERNEL_SIZE] = {0};
+    double bytes = 0;
+    for (int i = 0; i < num_frames; i++) {
+        const frame_t *f = &frames[i];
+        camera_set_kernel(CAMERA_KERNEL_SCALAR);
+        const double expected = frame_brightness(f);
+        if (expected < 0.0) {
+            fprintf(stderr, "%s: unsupported or truncated frame.\n", f->name);
+            failed = 1;
+            continue;
+        }
+        bytes += (double)f->hdr.size * iterations;
+
+        for (enum camera_kernels k = CAMERA_KERNEL_SCALAR; k < CAMERA_KERNEL_SIZE; k++) {
+            if (camera_set_kernel(k) != 0) {
+                continue;
+            }
+            const double br = frame_brightness(f);
+            if (br != expected) {
+                fprintf(stderr, "%s: %s kernel returned %lf, scalar %lf.\n", f->name, kernel_names[k], br, expected);
+                failed = 1;
+            }
+
+            struct timespec start, end;
+            volatile double sink = 0.0;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int it = 0; it < iterations; it++) {
+                sink += frame_brightness(f);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            ns[k] += elapsed_ns(&start, &end);
+        }
+    }
+
+    printf("%d frames, %d iterations each.\n", num_frames, iterations);
+    for (enum camera_kernels k = CAMERA_KERNEL_SCALAR; k < CAMERA_KERNEL_SIZE; k++) {
+        if (camera_set_kernel(k) != 0) {
+            printf("%-8s unsupported\n", kernel_names[k]);
+        } else if (ns[k] > 0) {
+            printf("%-8s %10.1lf ns/frame %8.2lf GB/s (%.2lfx scalar)\n", kernel_names[k],
+                   ns[k] / ((double)num_frames * iterations), bytes / ns[k], ns[CAMERA_KERNEL_SCALAR] / ns[k]);
+        }
+    }
+
+    for (int i = 0; i < num_frames; i++) {
+        free(frames[i].data);
+    }
+    free(frames);
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed;
+}
@@ -0,0 +1,15 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include "commons.h"
+
+/* Globals and log function normally provided by main.c and log.c */
+state_t state;
+conf_t conf;
+
+void log_message(const char *filename, int lineno, const char type, const char *log_msg, ...) {
+    va_list args;
+    va_start(args, log_msg);
+    fprintf(stderr, "(%c) %s:%d\t", type, filename, lineno);
+    vfprintf(stderr, log_msg, args);
+    va_end(args);
+}
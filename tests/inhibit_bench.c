@@ -0,0 +1,190 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <systemd/sd-bus.h>
+#include "commons.h"
+
+/*
+ * Create and drop thousands of ScreenSaver inhibitions, from many senders,
+ * against a running Clight instance owning org.freedesktop.ScreenSaver on the session bus.
+ * Each sender issues rounds * depth Inhibit calls in a few seconds: way more than
+ * the default Inhibit rate limit (60 per minute), thus disable it with a conf file containing:
+ * rate_limits = [ 12, 0, 6, 120 ];
+ * To not mess with user session, run it on a private bus, eg:
+ * dbus-run-session -- sh -c 'clight -c bench.conf & sleep 2; inhibit_bench -s 64 -r 50'
+ *
+ * Each round, every sender (a private bus connection, thus a unique name)
+ * inhibits depth times then uninhibits as many times, checking that:
+ * - a sender always gets back the same cookie while it holds the inhibition (refcount)
+ * - different senders never share a cookie
+ * - inhibition is only released when the last reference is dropped.
+ * A final round lets each sender drop the cookie of another one.
+ * Returns 1 if any check fails.
+ */
+
+#define SC_SERVICE "org.freedesktop.ScreenSaver"
+#define SC_PATH "/org/freedesktop/ScreenSaver"
+
+static int failed;
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static int inhibit(sd_bus *bus, uint32_t *cookie) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *reply = NULL;
+    int r = sd_bus_call_method(bus, SC_SERVICE, SC_PATH, SC_SERVICE, "Inhibit", &error, &reply, "ss", "inhibit_bench", "churn");
+    if (r >= 0) {
+        r = sd_bus_message_read(reply, "u", cookie);
+    } else if (sd_bus_error_has_name(&error, SD_BUS_ERROR_LIMITS_EXCEEDED)) {
+        fprintf(stderr, "Inhibit failed: rate limit exceeded (%s). Disable Inhibit rate limit in clight conf.\n", error.name);
+    } else {
+        fprintf(stderr, "Inhibit failed: %s\n", error.message);
+    }
+    sd_bus_message_unref(reply);
+    sd_bus_error_free(&error);
+    return r;
+}
+
+static int uninhibit(sd_bus *bus, uint32_t cookie) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    int r = sd_bus_call_method(bus, SC_SERVICE, SC_PATH, SC_SERVICE, "UnInhibit", &error, NULL, "u", cookie);
+    if (r < 0) {
+        fprintf(stderr, "UnInhibit(%u) failed: %s\n", cookie, error.message);
+    }
+    sd_bus_error_free(&error);
+    return r;
+}
+
+static int get_active(sd_bus *bus) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *reply = NULL;
+    int active = -1;
+    if (sd_bus_call_method(bus, SC_SERVICE, SC_PATH, SC_SERVICE, "GetActive", &error, &reply, NULL) >= 0) {
+        sd_bus_message_read(reply, "b", &active);
+    }
+    sd_bus_message_unref(reply);
+    sd_bus_error_free(&error);
+    return active;
+}
+
+static void check_active(sd_bus *bus, int expected, const char *when) {
+    const int active = get_active(bus);
+    if (active != expected) {
+        fprintf(stderr, "GetActive is %d %s, expected %d.\n", active, when, expected);
+        failed = 1;
+    }
+}
+
+/* Cookies held by different senders must all differ */
+static void check_unique(const uint32_t *cookies, int num_senders) {
+    for (int i = 0; i < num_senders; i++) {
+        for (int j = i + 1; j < num_senders; j++) {
+            if (cookies[i] == cookies[j]) {
+                fprintf(stderr, "Senders %d and %d share cookie %u.\n", i, j, cookies[i]);
+                failed = 1;
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int num_senders = 32, rounds = 20, depth = 4;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:d:")) != -1) {
+        switch (opt) {
+        case 's':
+            num_senders = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'd':
+            depth = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s senders] [-r rounds] [-d inhibitions per sender]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (num_senders < 2 || rounds <= 0 || depth <= 0) {
+        fprintf(stderr, "At least 2 senders, 1 round and 1 inhibition per sender are needed.\n");
+        return 2;
+    }
+
+    sd_bus **buses = calloc(num_senders, sizeof(sd_bus *));
+    uint32_t *cookies = calloc(num_senders, sizeof(uint32_t));
+    for (int i = 0; i < num_senders; i++) {
+        if (sd_bus_open_user(&buses[i]) < 0) {
+            fprintf(stderr, "Failed to open bus connection %d.\n", i);
+            return 2;
+        }
+    }
+    if (get_active(buses[0]) != 0) {
+        fprintf(stderr, "%s is not available or already inhibited.\n", SC_SERVICE);
+        return 2;
+    }
+
+    struct timespec start, end;
+    uint64_t num_calls = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds && !failed; r++) {
+        for (int i = 0; i < num_senders; i++) {
+            for (int d = 0; d < depth; d++) {
+                uint32_t cookie = 0;
+                if (inhibit(buses[i], &cookie) < 0) {
+                    failed = 1;
+                } else if (d == 0) {
+                    cookies[i] = cookie;
+                } else if (cookie != cookies[i]) {
+                    fprintf(stderr, "Sender %d got cookie %u, was holding %u.\n", i, cookie, cookies[i]);
+                    failed = 1;
+                }
+                num_calls++;
+            }
+        }
+        check_unique(cookies, num_senders);
+
+        for (int i = 0; i < num_senders; i++) {
+            for (int d = 0; d < depth; d++) {
+                if (d == depth - 1 && i == num_senders - 1) {
+                    /* Every other inhibition is gone: only this last reference keeps it active */
+                    check_active(buses[i], 1, "before last uninhibit");
+                }
+                if (uninhibit(buses[i], cookies[i]) < 0) {
+                    failed = 1;
+                }
+                num_calls++;
+            }
+        }
+        check_active(buses[0], 0, "after all senders uninhibited");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* Cross-sender drops: sender i releases the inhibition held by sender i + 1 */
+    for (int i = 0; i < num_senders && !failed; i++) {
+        if (inhibit(buses[i], &cookies[i]) < 0) {
+            failed = 1;
+        }
+    }
+    check_unique(cookies, num_senders);
+    for (int i = 0; i < num_senders && !failed; i++) {
+        if (uninhibit(buses[i], cookies[(i + 1) % num_senders]) < 0) {
+            failed = 1;
+        }
+    }
+    check_active(buses[0], 0, "after cross-sender uninhibit");
+
+    const double ns = elapsed_ns(&start, &end);
+    printf("%d senders, %d rounds, %d inhibitions per sender: %" PRIu64 " calls, %.1lf us/call.\n",
+           num_senders, rounds, depth, num_calls, ns / num_calls / 1000);
+
+    for (int i = 0; i < num_senders; i++) {
+        sd_bus_flush_close_unref(buses[i]);
+    }
+    free(buses);
+    free(cookies);
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed;
+}
@@ -0,0 +1,131 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <systemd/sd-bus.h>
+#include "commons.h"
+
+/*
+ * Check Conf SetMany against a running Clight instance on the session bus.
+ * To not mess with user session, run it on a private bus, eg:
+ * dbus-run-session -- sh -c 'clight & sleep 2; setmany_test'
+ *
+ * - AcEventCapture and BattDayCapture (same BL_TO_REQ topic) set together are both applied
+ * - a call with any invalid value fails, and none of its values is applied.
+ * Every changed property is restored at the end.
+ * Returns 1 if any check fails.
+ */
+
+#define CLIGHT_SERVICE "org.clight.clight"
+#define CONF_PATH "/org/clight/clight/Conf"
+#define CONF_IFACE "org.clight.clight.Conf"
+#define APPLY_RETRIES 20                    // requests are applied by their module: poll for a while
+
+static int failed;
+
+static int get_int(sd_bus *bus, const char *name, int *val) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *reply = NULL;
+    const char *key = NULL;
+    int r = sd_bus_call_method(bus, CLIGHT_SERVICE, CONF_PATH, CONF_IFACE, "GetMany", &error, &reply, "as", 1, name);
+    if (r >= 0) {
+        r = sd_bus_message_read(reply, "a{sv}", 1, &key, "i", val);
+    } else {
+        fprintf(stderr, "GetMany(%s) failed: %s\n", name, error.message);
+    }
+    sd_bus_message_unref(reply);
+    sd_bus_error_free(&error);
+    return r;
+}
+
+/* SetMany of an int property plus a property of signature sig2; returns the call result */
+static int set_two(sd_bus *bus, const char *name1, int val1, const char *name2, const char *sig2, ...) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *m = NULL;
+    int r = sd_bus_message_new_method_call(bus, &m, CLIGHT_SERVICE, CONF_PATH, CONF_IFACE, "SetMany");
+    if (r >= 0) {
+        r = sd_bus_message_open_container(m, SD_BUS_TYPE_ARRAY, "{sv}");
+    }
+    if (r >= 0) {
+        r = sd_bus_message_append(m, "{sv}", name1, "i", val1);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_open_container(m, SD_BUS_TYPE_DICT_ENTRY, "sv");
+    }
+    if (r >= 0) {
+        r = sd_bus_message_append(m, "s", name2);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_open_container(m, SD_BUS_TYPE_VARIANT, sig2);
+    }
+    if (r >= 0) {
+        va_list ap;
+        va_start(ap, sig2);
+        r = sd_bus_message_appendv(m, sig2, ap);
+        va_end(ap);
+    }
+    for (int i = 0; i < 3 && r >= 0; i++) {
+        r = sd_bus_message_close_container(m);
+    }
+    if (r >= 0) {
+        r = sd_bus_call(bus, m, 0, &error, NULL);
+        if (r < 0 && !sd_bus_error_has_name(&error, SD_BUS_ERROR_INVALID_ARGS)) {
+            fprintf(stderr, "SetMany(%s, %s) failed: %s\n", name1, name2, error.message);
+        }
+    }
+    sd_bus_message_unref(m);
+    sd_bus_error_free(&error);
+    return r;
+}
+
+static void check_value(sd_bus *bus, const char *name, int expected, const char *when) {
+    int val = 0;
+    for (int i = 0; i < APPLY_RETRIES; i++) {
+        if (get_int(bus, name, &val) >= 0 && val == expected) {
+            return;
+        }
+        usleep(50 * 1000);
+    }
+    fprintf(stderr, "%s is %d %s, expected %d.\n", name, val, when, expected);
+    failed = 1;
+}
+
+int main(void) {
+    sd_bus *bus = NULL;
+    int ev_to, day_to;
+    if (sd_bus_open_user(&bus) < 0 || get_int(bus, "AcEventCapture", &ev_to) < 0 || get_int(bus, "BattDayCapture", &day_to) < 0) {
+        fprintf(stderr, "%s is not available.\n", CLIGHT_SERVICE);
+        return 2;
+    }
+
+    /* Both are BL_TO_REQs: they must not replace each other while batched */
+    if (set_two(bus, "AcEventCapture", ev_to + 7, "BattDayCapture", "i", day_to + 11) < 0) {
+        failed = 1;
+    }
+    check_value(bus, "AcEventCapture", ev_to + 7, "after SetMany");
+    check_value(bus, "BattDayCapture", day_to + 11, "after SetMany");
+
+    /* Out of range temperature: nothing is applied */
+    if (set_two(bus, "BattDayCapture", day_to + 13, "DayTemp", "i", 100) >= 0) {
+        fprintf(stderr, "SetMany with DayTemp 100 succeeded.\n");
+        failed = 1;
+    }
+    check_value(bus, "BattDayCapture", day_to + 11, "after failed SetMany");
+
+    /* Malformed event time: nothing is applied */
+    if (set_two(bus, "AcEventCapture", ev_to, "Sunrise", "s", "99:99") >= 0) {
+        fprintf(stderr, "SetMany with Sunrise 99:99 succeeded.\n");
+        failed = 1;
+    }
+    check_value(bus, "AcEventCapture", ev_to + 7, "after failed SetMany");
+
+    if (set_two(bus, "AcEventCapture", ev_to, "BattDayCapture", "i", day_to) < 0) {
+        fprintf(stderr, "Failed to restore AcEventCapture and BattDayCapture.\n");
+        failed = 1;
+    }
+    check_value(bus, "AcEventCapture", ev_to, "after restore");
+    check_value(bus, "BattDayCapture", day_to, "after restore");
+
+    sd_bus_flush_close_unref(bus);
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed;
+}
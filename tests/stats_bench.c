@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <gsl/gsl_statistics_double.h>
+#include "stats.h"
+
+/*
+ * Time the per-sample cost of keeping mean and variance of a sliding window
+ * with stats_t, against the previous approach of storing samples in a plain ring
+ * and recomputing them through gsl_stats_mean()/gsl_stats_variance() over the whole window.
+ * Returns 1 if both paths disagree.
+ */
+
+#define MAX_REL_ERROR 1e-9
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char *argv[]) {
+    const int num_samples = argc > 1 ? atoi(argv[1]) : 100000;
+    if (num_samples <= 0) {
+        fprintf(stderr, "Usage: %s [samples]\n", argv[0]);
+        return 2;
+    }
+
+    double *input = malloc(num_samples * sizeof(double));
+    srand(42);
+    for (int i = 0; i < num_samples; i++) {
+        input[i] = (double)rand() / RAND_MAX;
+    }
+
+    int failed = 0;
+    const int capacities[] = { 5, 10, 50, 200, 1000 };
+    printf("%d samples per window size.\n", num_samples);
+    for (int c = 0; c < 5; c++) {
+        const int capacity = capacities[c];
+        struct timespec start, end;
+        double gsl_mean = 0.0, gsl_var = 0.0;
+        double st_mean = 0.0, st_var = 0.0;
+
+        double *ring = calloc(capacity, sizeof(double));
+        int count = 0, head = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < num_samples; i++) {
+            ring[head] = input[i];
+            head = (head + 1) % capacity;
+            if (count < capacity) {
+                count++;
+            }
+            gsl_mean = gsl_stats_mean(ring, 1, count);
+            gsl_var = count > 1 ? gsl_stats_variance_m(ring, 1, count, gsl_mean) : 0.0;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        const double gsl_ns = elapsed_ns(&start, &end);
+        free(ring);
+
+        stats_t s;
+        stats_init(&s, capacity, 0.0, false);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < num_samples; i++) {
+            stats_push(&s, input[i]);
+            st_mean = stats_mean(&s);
+            st_var = stats_variance(&s);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        const double st_ns = elapsed_ns(&start, &end);
+        stats_free(&s);
+
+        /* Only last window is compared, as both loops must stay free of checks */
+        if (fabs(gsl_mean - st_mean) > MAX_REL_ERROR * fmax(1.0, fabs(gsl_mean)) ||
+            fabs(gsl_var - st_var) > MAX_REL_ERROR * fmax(1.0, fabs(gsl_var))) {
+            fprintf(stderr, "Window %d: gsl mean %lf variance %lf, stats mean %lf variance %lf.\n",
+                    capacity, gsl_mean, gsl_var, st_mean, st_var);
+            failed = 1;
+        }
+        printf("window %-5d gsl %8.1lf ns/sample   stats %6.1lf ns/sample (%.1lfx)\n",
+               capacity, gsl_ns / num_samples, st_ns / num_samples, gsl_ns / st_ns);
+    }
+
+    free(input);
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed;
+}
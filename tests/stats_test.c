@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include "stats.h"
+
+/*
+ * Check stats_t running mean, sum, variance, EWMA and sliding median
+ * against brute force computations over the same window,
+ * while the ring wraps many times, for a few window sizes.
+ */
+
+#define MAX_REL_ERROR 1e-9
+#define NUM_SAMPLES 5000
+
+static int failed;
+
+static int cmp_double(const void *a, const void *b) {
+    const double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void check_value(const char *what, int capacity, int i, double expected, double val) {
+    const double err = fabs(expected - val) / fmax(1.0, fabs(expected));
+    if (!(err <= MAX_REL_ERROR)) {
+        printf("capacity %d, sample %d: %s %lf, expected %lf\n", capacity, i, what, val, expected);
+        failed = 1;
+    }
+}
+
+/* Window of last min(n, capacity) samples, oldest first */
+static int window_of(const double *all, int n, int capacity, double *win) {
+    const int count = n < capacity ? n : capacity;
+    memcpy(win, &all[n - count], count * sizeof(double));
+    return count;
+}
+
+static void check_window(int capacity, double alpha, int quantized) {
+    stats_t s;
+    if (stats_init(&s, capacity, alpha, true) != 0) {
+        printf("capacity %d: init failed\n", capacity);
+        failed = 1;
+        return;
+    }
+
+    double *all = malloc(NUM_SAMPLES * sizeof(double));
+    double *win = malloc(capacity * sizeof(double));
+    double ewma = 0.0;
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        /* Quantized samples exercise duplicates in the sorted window */
+        const double v = quantized ? rand() % 8 : (double)rand() / RAND_MAX * 100.0 - 50.0;
+        all[i] = v;
+        ewma = i == 0 ? v : ewma + alpha * (v - ewma);
+        stats_push(&s, v);
+
+        const int count = window_of(all, i + 1, capacity, win);
+        double sum = 0.0;
+        for (int j = 0; j < count; j++) {
+            sum += win[j];
+        }
+        const double mean = sum / count;
+        double m2 = 0.0;
+        for (int j = 0; j < count; j++) {
+            m2 += (win[j] - mean) * (win[j] - mean);
+        }
+        const double variance = count > 1 ? m2 / (count - 1) : 0.0;
+        qsort(win, count, sizeof(double), cmp_double);
+        const double median = count % 2 ? win[count / 2] : (win[count / 2 - 1] + win[count / 2]) / 2;
+
+        check_value("mean", capacity, i, mean, stats_mean(&s));
+        check_value("sum", capacity, i, sum, stats_sum(&s));
+        check_value("variance", capacity, i, variance, stats_variance(&s));
+        check_value("ewma", capacity, i, ewma, stats_ewma(&s));
+        check_value("median", capacity, i, median, stats_median(&s));
+        if (stats_full(&s) != (i + 1 >= capacity)) {
+            printf("capacity %d, sample %d: wrong full state\n", capacity, i);
+            failed = 1;
+        }
+    }
+
+    /* After a reset, window must behave as a fresh one */
+    stats_reset(&s);
+    stats_push(&s, 3.0);
+    check_value("mean after reset", capacity, 0, 3.0, stats_mean(&s));
+    check_value("variance after reset", capacity, 0, 0.0, stats_variance(&s));
+    check_value("median after reset", capacity, 0, 3.0, stats_median(&s));
+
+    stats_free(&s);
+    free(all);
+    free(win);
+}
+
+static void check_edge_cases(void) {
+    stats_t s;
+    if (stats_init(&s, 0, 0.0, false) == 0) {
+        printf("Zero capacity window was not rejected.\n");
+        failed = 1;
+    }
+    /* Pushing to an invalid window must be harmless */
+    stats_push(&s, 1.0);
+
+    stats_init(&s, 4, 0.0, false);
+    if (!isnan(stats_median(&s))) {
+        printf("Median without sorted window is not NAN.\n");
+        failed = 1;
+    }
+    stats_push(&s, 1.0);
+    stats_push(&s, 2.0);
+    /* alpha 0: EWMA stays at first sample */
+    check_value("ewma with alpha 0", 4, 1, 1.0, stats_ewma(&s));
+    stats_free(&s);
+}
+
+int main(void) {
+    srand(42);
+    const int capacities[] = { 1, 2, 3, 10, 64, 1000 };
+    for (int c = 0; c < 6; c++) {
+        check_window(capacities[c], 2.0 / (capacities[c] + 1), 0);
+        check_window(capacities[c], 0.5, 1);
+    }
+    check_edge_cases();
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed;
+}
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include "my_math.h"
+
+/*
+ * Time calculate_sun_events() yearly batch against the old
+ * single precision algorithm, that computed a single event per call.
+ */
+
+#define LEGACY_ZENITH -0.83
+
+static float to_hours(const float deg) {
+    return deg / 15;
+}
+
+/* Old algorithm, minus the time_t conversions: returns UTC hour of event, or -2 when there is none */
+static float legacy_event(const float lat, const float lng, int yday, enum day_events event) {
+    float lngHour = to_hours(lng);
+    float t;
+    if (event == SUNRISE) {
+        t = yday + (6.0 - lngHour) / 24.0;
+    } else {
+        t = yday + (18.0 - lngHour) / 24.0;
+    }
+    float M = (0.9856 * t) - 3.289;
+    float L = fmod(M + 1.916 * sin(degToRad(M)) + 0.020 * sin(2 * degToRad(M)) + 282.634, 360.0);
+    float RA = fmod(radToDeg(atan(0.91764 * tan(degToRad(L)))), 360.0);
+    float Lquadrant = floor(L / 90) * 90;
+    float RAquadrant = floor(RA / 90) * 90;
+    RA += (Lquadrant - RAquadrant);
+    RA = to_hours(RA);
+    float sinDec = 0.39782 * sin(degToRad(L));
+    float cosDec = cos(asin(sinDec));
+    float cosH = sin(degToRad(LEGACY_ZENITH)) - (sinDec * sin(degToRad(lat))) / (cosDec * cos(degToRad(lat)));
+    if ((cosH > 1 && event == SUNRISE) || (cosH < -1 && event == SUNSET)) {
+        return -2;
+    }
+    float H;
+    if (event == SUNRISE) {
+        H = 360.0 - radToDeg(acos(cosH));
+    } else {
+        H = radToDeg(acos(cosH));
+    }
+    H = to_hours(H);
+    float T = H + RA - (0.06571 * t) - 6.622;
+    return fmod(24 + fmod(T - lngHour, 24.0), 24.0);
+}
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char *argv[]) {
+    const int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    const double lats[] = { -45.0, 0.0, 45.5, 60.2 };
+    double sunrise[366], sunset[366];
+    volatile double sink = 0.0;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int it = 0; it < iterations; it++) {
+        for (int l = 0; l < 4; l++) {
+            calculate_sun_events(lats[l], 11.3, 2021, 0, 366, sunrise, sunset);
+            sink += sunrise[it % 366] + sunset[it % 366];
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double new_ns = elapsed_ns(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int it = 0; it < iterations; it++) {
+        for (int l = 0; l < 4; l++) {
+            for (int day = 0; day < 366; day++) {
+                sink += legacy_event(lats[l], 11.3, day, SUNRISE) + legacy_event(lats[l], 11.3, day, SUNSET);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double legacy_ns = elapsed_ns(&start, &end);
+
+    const double num_events = 2.0 * 366 * 4 * iterations;
+    printf("calculate_sun_events: %.1lf ns/event\n", new_ns / num_events);
+    printf("legacy algorithm:     %.1lf ns/event\n", legacy_ns / num_events);
+    printf("ratio:                %.2lfx\n", new_ns / legacy_ns);
+    return 0;
+}
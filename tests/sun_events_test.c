@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "my_math.h"
+#include "ephemeris.h"
+
+/*
+ * Accuracy of calculate_sun_events() over a lat/lon/date grid
+ * against the same NOAA algorithm iterated until convergence,
+ * plus a few almanac values and polar days/nights.
+ */
+
+#define MAX_GRID_ERROR 30.0         // seconds
+#define MAX_POLAR_ERROR 120.0      // seconds; event times change fast near polar circles
+#define MAX_ALMANAC_ERROR 180.0     // seconds; almanac values are rounded to the minute
+
+static int failed;
+
+/* NOAA sunrise hour angle (deg) and solar noon (minutes from UTC midnight) at given julian day */
+static void reference_position(double jd, double lat, double lon, double *ha, double *noon) {
+    const double T = (jd - 2451545.0) / 36525.0;
+    const double L0 = fmod(280.46646 + T * (36000.76983 + T * 0.0003032), 360.0);
+    const double M = degToRad(357.52911 + T * (35999.05029 - 0.0001537 * T));
+    const double e = 0.016708634 - T * (0.000042037 + 0.0000001267 * T);
+    const double C = sin(M) * (1.914602 - T * (0.004817 + 0.000014 * T)) + sin(2 * M) * (0.019993 - 0.000101 * T) + sin(3 * M) * 0.000289;
+    const double omega = degToRad(125.04 - 1934.136 * T);
+    const double lambda = degToRad(L0 + C - 0.00569 - 0.00478 * sin(omega));
+    const double eps0 = 23.0 + (26.0 + (21.448 - T * (46.815 + T * (0.00059 - T * 0.001813))) / 60.0) / 60.0;
+    const double eps = degToRad(eps0 + 0.00256 * cos(omega));
+    const double decl = asin(sin(eps) * sin(lambda));
+    const double y = tan(eps / 2) * tan(eps / 2);
+    const double L0r = degToRad(L0);
+    const double eq_time = 4 * radToDeg(y * sin(2 * L0r) - 2 * e * sin(M) + 4 * e * y * sin(M) * cos(2 * L0r) -
+                                        0.5 * y * y * sin(4 * L0r) - 1.25 * e * e * sin(2 * M));
+    const double latr = degToRad(lat);
+    *ha = radToDeg(acos(cos(degToRad(90.833)) / (cos(latr) * cos(decl)) - tan(latr) * tan(decl)));
+    *noon = 720 - 4 * lon - eq_time;
+}
+
+/* Iterate event time until it is consistent with the solar position at that same time */
+static double reference_event(double lat, double lon, int year, int yday, enum day_events ev) {
+    struct tm jan1 = { .tm_year = year - 1900, .tm_mday = 1 };
+    const double jd_day = timegm(&jan1) / 86400.0 + 2440587.5 + yday;
+    const double sign = ev == SUNRISE ? -1 : 1;
+
+    double ha, noon;
+    reference_position(jd_day + 0.5 - lon / 360.0, lat, lon, &ha, &noon);
+    double t = noon + sign * 4 * ha;
+    for (int i = 0; i < 50 && !isnan(t); i++) {
+        reference_position(jd_day + t / 1440.0, lat, lon, &ha, &noon);
+        const double next = noon + sign * 4 * ha;
+        if (fabs(next - t) < 1e-6) {
+            t = next;
+            break;
+        }
+        t = next;
+    }
+    return t * 60;
+}
+
+static void check_grid(void) {
+    const int year = 2021;
+    double sunrise[365], sunset[365];
+    double max_err = 0.0;
+    int num_events = 0, num_no_events = 0;
+
+    /* Polar boundary latitudes are exercised by check_polar_boundary() */
+    for (int lat = -64; lat <= 64; lat += 4) {
+        for (int lon = -180; lon <= 180; lon += 15) {
+            calculate_sun_events(lat, lon, year, 0, 365, sunrise, sunset);
+            for (int day = 0; day < 365; day += 3) {
+                const double *computed[SIZE_EVENTS] = { sunrise, sunset };
+                for (int ev = SUNRISE; ev < SIZE_EVENTS; ev++) {
+                    const double ref = reference_event(lat, lon, year, day, ev);
+                    const double val = computed[ev][day];
+                    if (isnan(ref) != isnan(val)) {
+                        printf("lat %d lon %d yday %d ev %d: reference %lf, computed %lf\n", lat, lon, day, ev, ref, val);
+                        failed = 1;
+                    } else if (isnan(ref)) {
+                        num_no_events++;
+                    } else {
+                        max_err = fmax(max_err, fabs(ref - val));
+                        num_events++;
+                    }
+                }
+            }
+        }
+    }
+    printf("Grid: %d events, %d without event, max error %.2lfs.\n", num_events, num_no_events, max_err);
+    if (max_err > MAX_GRID_ERROR) {
+        failed = 1;
+    }
+}
+
+/*
+ * Near polar circles, where events appear and disappear during the year.
+ * A computed event may fall in next (or previous) UTC day, where the converged solution
+ * does not exist anymore: that is fine as long as a missing event is never reported for a day that has one.
+ */
+static void check_polar_boundary(void) {
+    const int year = 2021;
+    double sunrise[365], sunset[365];
+    double max_err = 0.0;
+    int num_events = 0, num_no_events = 0;
+
+    const int lats[] = { -76, -72, -68, -64, 64, 68, 72, 76 };
+    for (int l = 0; l < 8; l++) {
+        const int lat = lats[l];
+        for (int lon = -180; lon <= 180; lon += 15) {
+            calculate_sun_events(lat, lon, year, 0, 365, sunrise, sunset);
+            for (int day = 0; day < 365; day += 3) {
+                const double *computed[SIZE_EVENTS] = { sunrise, sunset };
+                for (int ev = SUNRISE; ev < SIZE_EVENTS; ev++) {
+                    const double ref = reference_event(lat, lon, year, day, ev);
+                    const double val = computed[ev][day];
+                    if (isnan(ref) && !isnan(val) && (val < 0 || val >= 86400)) {
+                        num_no_events++;
+                    } else if (isnan(ref) != isnan(val)) {
+                        printf("lat %d lon %d yday %d ev %d: reference %lf, computed %lf\n", lat, lon, day, ev, ref, val);
+                        failed = 1;
+                    } else if (isnan(ref)) {
+                        num_no_events++;
+                    } else {
+                        max_err = fmax(max_err, fabs(ref - val));
+                        num_events++;
+                    }
+                }
+            }
+        }
+    }
+    printf("Polar boundary: %d events, %d without event, max error %.2lfs.\n", num_events, num_no_events, max_err);
+    if (max_err > MAX_POLAR_ERROR) {
+        failed = 1;
+    }
+}
+
+static void check_almanac(const char *name, double lat, double lon, int year, int yday, double rise_h, double set_h) {
+    double sunrise, sunset;
+    calculate_sun_events(lat, lon, year, yday, 1, &sunrise, &sunset);
+    const double rise_err = fabs(sunrise - rise_h * 3600);
+    const double set_err = fabs(sunset - set_h * 3600);
+    printf("%s: sunrise error %.0lfs, sunset error %.0lfs.\n", name, rise_err, set_err);
+    if (!(rise_err <= MAX_ALMANAC_ERROR && set_err <= MAX_ALMANAC_ERROR)) {
+        failed = 1;
+    }
+}
+
+static void check_polar(const char *name, int year, int yday) {
+    const double lat = 69.65, lon = 18.96;  // Tromsø
+    double sunrise, sunset;
+    calculate_sun_events(lat, lon, year, yday, 1, &sunrise, &sunset);
+    int seconds;
+    const int r_rise = ephemeris_get(lat, lon, SUNRISE, year, yday, &seconds);
+    const int r_set = ephemeris_get(lat, lon, SUNSET, year, yday, &seconds);
+    printf("%s: events %lf %lf, ephemeris %d %d.\n", name, sunrise, sunset, r_rise, r_set);
+    if (!isnan(sunrise) || !isnan(sunset) || r_rise != -2 || r_set != -2) {
+        failed = 1;
+    }
+}
+
+int main(void) {
+    /* Do not pollute user cache with ephemeris tables */
+    char cache_dir[] = "/tmp/clight-test-XXXXXX";
+    if (!mkdtemp(cache_dir)) {
+        return 1;
+    }
+    setenv("XDG_CACHE_HOME", cache_dir, 1);
+
+    check_grid();
+    check_polar_boundary();
+
+    /* UTC hours; negative means previous UTC day */
+    check_almanac("Equator, 2020-03-20", 0.0, 0.0, 2020, 79, 6 + 4 / 60.0, 18 + 11 / 60.0);
+    check_almanac("Greenwich, 2020-06-21", 51.4779, 0.0, 2020, 172, 3 + 43 / 60.0, 20 + 21 / 60.0);
+    check_almanac("Sydney, 2020-12-21", -33.8688, 151.2093, 2020, 355, -(5 + 19 / 60.0), 9 + 5 / 60.0);
+
+    check_polar("Tromsø midnight sun, 2020-06-21", 2020, 172);
+    check_polar("Tromsø polar night, 2020-12-21", 2020, 355);
+
+    char cache_file[PATH_MAX + 1];
+    snprintf(cache_file, PATH_MAX, "%s/clight-ephemeris", cache_dir);
+    unlink(cache_file);
+    rmdir(cache_dir);
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed;
+}